@@ -0,0 +1,227 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Compares reading the ADCs of lots of devices with a blocking thread per device against
+// a single thread using the engine. Linux only.
+// Uses every MCP2221 that's plugged in, or simulated devices if there aren't any:
+//   ./engine_bench [seconds] [number of simulated devices]
+// The library should be built with make HIDRAW=1 so real devices go through io_uring.
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "../../libmcp2221/libmcp2221.h"
+
+static mcp2221_t** devices;
+static int deviceCount;
+static int seconds = 5;
+static volatile int running;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static double cpuTime(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + (usage.ru_utime.tv_usec / 1e6) + usage.ru_stime.tv_sec + (usage.ru_stime.tv_usec / 1e6);
+}
+
+static int threadCount(void)
+{
+	DIR* dir = opendir("/proc/self/task");
+	if(!dir)
+		return -1;
+
+	int count = 0;
+	struct dirent* ent;
+	while((ent = readdir(dir)))
+	{
+		if(ent->d_name[0] != '.')
+			count++;
+	}
+	closedir(dir);
+
+	return count;
+}
+
+static void printResult(const char* name, unsigned long ops, int threads, double wall, double cpu)
+{
+	printf("%-20s %10.0f ops/s  %6.2f CPU s  %5.1f%% CPU  %4d threads\n", name, ops / wall, cpu, (cpu / wall) * 100, threads);
+}
+
+// Thread per device, each one blocking in mcp2221_readADC()
+
+typedef struct{
+	mcp2221_t* device;
+	unsigned long ops;
+}worker_t;
+
+static void* worker(void* arg)
+{
+	worker_t* w = arg;
+	int adc[MCP2221_ADC_COUNT];
+
+	while(running)
+	{
+		if(mcp2221_readADC(w->device, adc) == MCP2221_SUCCESS)
+			w->ops++;
+	}
+
+	return NULL;
+}
+
+static void benchThreads(void)
+{
+	worker_t* workers = calloc(deviceCount, sizeof(worker_t));
+	pthread_t* threads = calloc(deviceCount, sizeof(pthread_t));
+
+	running = 1;
+	double cpuStart = cpuTime();
+	double start = now();
+
+	for(int i=0;i<deviceCount;i++)
+	{
+		workers[i].device = devices[i];
+		pthread_create(&threads[i], NULL, worker, &workers[i]);
+	}
+
+	int count = threadCount();
+
+	struct timespec delay = {seconds, 0};
+	nanosleep(&delay, NULL);
+	running = 0;
+
+	unsigned long ops = 0;
+	for(int i=0;i<deviceCount;i++)
+	{
+		pthread_join(threads[i], NULL);
+		ops += workers[i].ops;
+	}
+
+	printResult("Thread per device", ops, count, now() - start, cpuTime() - cpuStart);
+
+	free(threads);
+	free(workers);
+}
+
+// One thread, a STATUSSET report in flight for every device
+
+static mcp2221_report_t* reports;
+static unsigned long engineOps;
+
+static void engineDone(mcp2221_t* device, mcp2221_error result, mcp2221_report_t* report, void* userData)
+{
+	mcp2221_engine_t* engine = userData;
+
+	if(result == MCP2221_SUCCESS)
+		engineOps++;
+
+	// Send it again straight away
+	if(running)
+	{
+		memset(report->data, 0x00, MCP2221_REPORT_SIZE);
+		report->data[0] = 0x10;
+		mcp2221_engineSubmit(engine, device, report, engineDone, engine);
+	}
+}
+
+static void benchEngine(void)
+{
+	mcp2221_engine_t* engine = mcp2221_engineCreate(deviceCount);
+	if(!engine)
+	{
+		puts("Engine create failed");
+		return;
+	}
+
+	reports = calloc(deviceCount, sizeof(mcp2221_report_t));
+
+	running = 1;
+	engineOps = 0;
+	double cpuStart = cpuTime();
+	double start = now();
+	double end = start + seconds;
+
+	for(int i=0;i<deviceCount;i++)
+	{
+		reports[i].data[0] = 0x10;
+		mcp2221_engineSubmit(engine, devices[i], &reports[i], engineDone, engine);
+	}
+
+	int count = threadCount();
+
+	while(now() < end)
+		mcp2221_engineRun(engine, 1);
+
+	running = 0;
+	mcp2221_engineDestroy(engine);
+
+	printResult("Engine", engineOps, count, now() - start, cpuTime() - cpuStart);
+
+	free(reports);
+}
+
+int main(int argc, char* argv[])
+{
+	if(argc > 1)
+		seconds = atoi(argv[1]);
+	int simCount = (argc > 2) ? atoi(argv[2]) : 100;
+
+	mcp2221_init();
+
+	int count = mcp2221_find(MCP2221_DEFAULT_VID, MCP2221_DEFAULT_PID, NULL, NULL, NULL);
+	if(count > 0)
+	{
+		devices = calloc(count, sizeof(mcp2221_t*));
+		for(int i=0;i<count;i++)
+		{
+			devices[deviceCount] = mcp2221_open_byIndex(i);
+			if(devices[deviceCount])
+				deviceCount++;
+		}
+		printf("Using %d devices\n", deviceCount);
+	}
+	else
+	{
+		devices = calloc(simCount, sizeof(mcp2221_t*));
+		for(int i=0;i<simCount;i++)
+		{
+			devices[deviceCount] = mcp2221_open_sim();
+			if(devices[deviceCount])
+				deviceCount++;
+		}
+		printf("No devices found, using %d simulated devices\n", deviceCount);
+	}
+
+	if(!deviceCount)
+	{
+		mcp2221_exit();
+		return 0;
+	}
+
+	benchThreads();
+	benchEngine();
+
+	for(int i=0;i<deviceCount;i++)
+		mcp2221_close(devices[i]);
+	free(devices);
+
+	mcp2221_exit();
+
+	return 0;
+}
@@ -13,6 +13,7 @@
 #include <wchar.h>
 
 #define MCP2221_STR_LEN		31	/**< Maximum length of wchar_t USB descriptor strings + 1 for null term */
+#define MCP2221_PASSWORD_LEN	8	/**< Flash password length in bytes */
 #define MCP2221_GPIO_COUNT	4	/**< GPIO pin count */
 #define MCP2221_DAC_MAX		31	/**< Maximum value of DAC output */
 #define MCP2221_ADC_COUNT	3	/**< ADC count */
@@ -24,6 +25,9 @@
 
 #define MCP2221_REPORT_SIZE	64	/**< HID Report size */
 
+#define MCP2221_TIMEOUT_ADAPTIVE	0	/**< Timeout is worked out from measured round trip times (default) */
+#define MCP2221_TIMEOUT_INFINITE	-1	/**< Wait forever for a response */
+
 /**
  * \enum mcp2221_error 
  * \brief Error codes
@@ -33,7 +37,11 @@ typedef enum
 	MCP2221_SUCCESS = 0,		/**< All is well */
 	MCP2221_ERROR = -1,			/**< General error */
 	MCP2221_INVALID_ARG = -2,	/**< Invalid argument supplied, probably a null pointer */
-	MCP2221_ERROR_HID = -3		/**< HIDAPI returned an error */
+	MCP2221_ERROR_HID = -3,		/**< HIDAPI returned an error */
+	MCP2221_ERROR_TIMEOUT = -4,	/**< No response from the device before the timeout expired */
+	MCP2221_ERROR_STATUS = -5,	/**< The device responded to a flash command with a failure status, the response is still placed in the report */
+	MCP2221_ERROR_VERIFY = -6,	/**< Flash contents read back after writing didn't match */
+	MCP2221_ERROR_ACCESS = -7	/**< Flash is password protected or locked, or the password was wrong */
 }mcp2221_error;
 
 /**
@@ -138,6 +146,17 @@ typedef enum
 	MCP2221_PWRSRC_BUSPOWERED = 0
 }mcp2221_pwrsrc_t;
 
+/**
+ * \enum mcp2221_security_t 
+ * \brief Flash security setting
+ */
+typedef enum
+{
+	MCP2221_SECURITY_UNSECURED = 0,	/**< Flash can be written by anything */
+	MCP2221_SECURITY_PASSWORD = 1,	/**< Flash writes need the password to be sent first, see mcp2221_unlockFlash() */
+	MCP2221_SECURITY_LOCKED = 2		/**< Flash is permanently locked */
+}mcp2221_security_t;
+
 /**
  * \enum mcp2221_wakeup_t 
  * \brief Remote wakeup (wakeup the USB host from sleep mode)
@@ -233,6 +252,51 @@ typedef struct{
 	int milliamps;							/**< Enumerated current limit */
 }mcp2221_usbinfo_t;
 
+/**
+* \struct mcp2221_report_t
+* \brief Report buffer with room for the HID report ID in front of the report data
+*
+* Reports passed around in one of these can be sent without first being copied into a bigger buffer to add the report ID.
+*/
+typedef struct{
+	uint8_t reportId;						/**< HID report ID, filled in by the transport */
+	uint8_t data[MCP2221_REPORT_SIZE];		/**< Report data */
+}mcp2221_report_t;
+
+/**
+* \struct mcp2221_transport_t
+* \brief Transport backend, moves reports between the library and the device
+*
+* \p handle is whatever was passed to mcp2221_open_transport() when the device was opened.
+* The report given to \p send is always the \p data of a ::mcp2221_report_t, so the byte before it can be used for the report ID.
+*/
+typedef struct{
+	mcp2221_error (*send)(void* handle, uint8_t* report);		/**< Send a ::MCP2221_REPORT_SIZE byte report, report[-1] is free for the report ID */
+	mcp2221_error (*receive)(void* handle, uint8_t* report, int timeout);	/**< Receive a ::MCP2221_REPORT_SIZE byte report, waiting up to \p timeout milliseconds (-1 = forever), return ::MCP2221_ERROR_TIMEOUT if nothing arrived */
+	void (*close)(void* handle);								/**< Close the handle */
+	int (*pollFd)(void* handle);								/**< Get a file descriptor that becomes readable when a response is waiting, or -1 if not supported. Can be NULL */
+}mcp2221_transport_t;
+
+/**
+* \struct mcp2221_stats_t
+* \brief Transport statistics, see mcp2221_getStats()
+*/
+typedef struct{
+	uint32_t timeouts;			/**< Responses that didn't arrive before the timeout */
+	uint32_t staleResponses;	/**< Responses thrown away because they belonged to an earlier request */
+	uint32_t resyncs;			/**< Requests which had to skip over stale responses before getting their own */
+	uint32_t statusErrors;		/**< Flash command responses with a failure status */
+	uint32_t retries;			/**< Requests sent again after a HID error or timeout, see mcp2221_setRetry() */
+	uint32_t recovered;			/**< Requests that worked after being retried */
+	uint32_t suppressedWrites;	/**< Writes that weren't sent because they wouldn't have changed anything, see mcp2221_setWriteSuppression() */
+}mcp2221_stats_t;
+
+/**
+* \struct mcp2221_ctx_t
+* \brief Enumeration state (the devices found by mcp2221_ctxFind() and the open settings), see mcp2221_ctxCreate()
+*/
+typedef struct mcp2221_ctx_t mcp2221_ctx_t;
+
 /**
 * \struct mcp2221_t
 * \brief TODO
@@ -241,7 +305,8 @@ typedef struct{
 	void* handle;	/**< Device handle */
 	char* path;		/**< Device path, used to identify the physical device */
 	uint8_t gpioCache[MCP2221_GPIO_COUNT];	/**< GPIO config cache */
-	mcp2221_usbinfo_t usbInfo;
+	mcp2221_usbinfo_t usbInfo;	/**< USB info, the descriptors and versions are only filled in after mcp2221_getUSBInfo() when lazy open is enabled */
+	struct mcp2221_private_t* priv;	/**< Library internals (transport, caches etc), not part of the API. Kept last so the fields above don't move */
 }mcp2221_t;
 
 /**
@@ -253,6 +318,19 @@ typedef struct{
 	uint8_t SDA;	/**< I2C SDA Value */
 }mcp2221_i2cpins_t;
 
+/**
+* \struct mcp2221_status_t
+* \brief Everything from a status report, see mcp2221_readStatus()
+*/
+typedef struct{
+	int adc[MCP2221_ADC_COUNT];		/**< ADC values */
+	int interrupt;					/**< Interrupt state (0 = not triggered, 1 = triggered) */
+	mcp2221_i2c_state_t i2cState;	/**< I2C state */
+	mcp2221_i2cpins_t i2cPins;		/**< I2C pin values */
+	char firmware[2];				/**< Firmware version */
+	char hardware[2];				/**< Hardware version */
+}mcp2221_status_t;
+
 /**
 * \struct mcp2221_gpioconf_t
 * \brief GPIO configuration
@@ -273,8 +351,135 @@ typedef struct{
 	mcp2221_gpioconf_t conf[MCP2221_GPIO_COUNT];
 }mcp2221_gpioconfset_t;
 
+/**
+* \struct mcp2221_sramupdate_t
+* \brief SRAM settings changes waiting to be sent in one go, see mcp2221_SRAMUpdateInit()
+*/
+typedef struct{
+	mcp2221_report_t report;	/**< SETSRAM report being built up */
+}mcp2221_sramupdate_t;
+
+#define MCP2221_SNAPSHOT_SIZE	(8 + (7 * MCP2221_REPORT_SIZE))	/**< Size of a ::mcp2221_snapshot_t */
+
+/**
+* \struct mcp2221_snapshot_t
+* \brief SRAM settings and all flash sections of a device as a versioned binary blob, see mcp2221_snapshotTake()
+*
+* The contents are plain bytes so a snapshot can be written to a file and loaded back on any machine.
+*/
+typedef struct{
+	uint8_t data[MCP2221_SNAPSHOT_SIZE];	/**< Snapshot data */
+}mcp2221_snapshot_t;
+
+/**
+* \enum mcp2221_snapshot_part_t
+* \brief Parts of a snapshot, see mcp2221_snapshotDiff() and mcp2221_snapshotApply()
+*/
+typedef enum
+{
+	MCP2221_SNAPSHOT_CHIPSETTINGS	= 1,	/**< Chip settings flash section */
+	MCP2221_SNAPSHOT_GPIOSETTINGS	= 2,	/**< GPIO settings flash section */
+	MCP2221_SNAPSHOT_MANUFACTURER	= 4,	/**< Manufacturer descriptor flash section */
+	MCP2221_SNAPSHOT_PRODUCT		= 8,	/**< Product descriptor flash section */
+	MCP2221_SNAPSHOT_SERIAL			= 16,	/**< Serial descriptor flash section */
+	MCP2221_SNAPSHOT_FACTORYSERIAL	= 32,	/**< Factory serial flash section (read-only, never applied) */
+	MCP2221_SNAPSHOT_SRAM			= 64,	/**< SRAM settings (clock out, DAC, ADC, interrupt and GPIO) */
+	MCP2221_SNAPSHOT_ALL			= 127	/**< Everything */
+}mcp2221_snapshot_part_t;
+
+
+
+
+/**
+* \struct mcp2221_request_t
+* \brief Handle for a request submitted with mcp2221_asyncSubmit()
+*/
+typedef struct mcp2221_request_t mcp2221_request_t;
+
+/**
+* @brief Job run on the I/O thread of a device
+*
+* @param [device] Device the job was submitted to
+* @param [arg] Pointer passed to mcp2221_asyncSubmit()
+* @return ::mcp2221_error error code, passed on to the callback and mcp2221_asyncWait()
+*/
+typedef mcp2221_error (*mcp2221_job_t)(mcp2221_t* device, void* arg);
+
+/**
+* @brief Completion callback, called on the I/O thread once a job has finished
+*
+* @param [device] Device the job was submitted to
+* @param [result] Value returned by the job
+* @param [userData] Pointer passed to mcp2221_asyncSubmit()
+*/
+typedef void (*mcp2221_callback_t)(mcp2221_t* device, mcp2221_error result, void* userData);
+
+/**
+* \struct mcp2221_engine_t
+* \brief Engine for driving many devices from one thread, see mcp2221_engineCreate()
+*/
+typedef struct mcp2221_engine_t mcp2221_engine_t;
+
+/**
+* @brief Called from mcp2221_engineRun() when a request has finished
+*
+* @param [device] Device the report was sent to
+* @param [result] ::mcp2221_error error code
+* @param [report] The report buffer passed to mcp2221_engineSubmit(), now holding the response
+* @param [userData] Pointer passed to mcp2221_engineSubmit()
+*/
+typedef void (*mcp2221_engine_callback_t)(mcp2221_t* device, mcp2221_error result, mcp2221_report_t* report, void* userData);
+
+/**
+* \struct mcp2221_monitor_t
+* \brief Hot-plug monitor, see mcp2221_monitorCreate()
+*/
+typedef struct mcp2221_monitor_t mcp2221_monitor_t;
+
+/**
+* @brief Called from mcp2221_monitorRun() when a device has been plugged in or unplugged
+*
+* @param [idx] Index of the device, for mcp2221_open_byIndex()
+* @param [path] Device path
+* @param [userData] Pointer passed to mcp2221_monitorCreate()
+*/
+typedef void (*mcp2221_hotplug_t)(int idx, const char* path, void* userData);
+
+/**
+* \enum mcp2221_profile_field_t
+* \brief Fields of a ::mcp2221_profile_t that should be applied
+*/
+typedef enum
+{
+	MCP2221_PROFILE_MANUFACTURER	= 1,	/**< Manufacturer descriptor */
+	MCP2221_PROFILE_PRODUCT			= 2,	/**< Product descriptor */
+	MCP2221_PROFILE_VIDPID			= 4,	/**< VID and PID */
+	MCP2221_PROFILE_MILLIAMPS		= 8,	/**< USB current limit */
+	MCP2221_PROFILE_GPIOCONF		= 16	/**< GPIO power-up configuration */
+}mcp2221_profile_field_t;
 
+/**
+* \struct mcp2221_profile_t
+* \brief Flash settings to apply with mcp2221_provision() and mcp2221_provisionAll(), see mcp2221_profileInit()
+*/
+typedef struct{
+	int fields;							/**< Which fields to apply (see ::mcp2221_profile_field_t) */
+	wchar_t manufacturer[MCP2221_STR_LEN];	/**< Manufacturer descriptor */
+	wchar_t product[MCP2221_STR_LEN];		/**< Product descriptor */
+	int vid;							/**< VID */
+	int pid;							/**< PID */
+	int milliamps;						/**< USB current limit */
+	mcp2221_gpioconfset_t gpioConf;		/**< GPIO power-up configuration */
+}mcp2221_profile_t;
 
+/**
+* \struct mcp2221_provision_result_t
+* \brief Outcome of provisioning a device
+*/
+typedef struct{
+	mcp2221_error result;	/**< ::MCP2221_SUCCESS if the profile was applied and verified */
+	int changed;			/**< Number of profile fields that were different and had to be written */
+}mcp2221_provision_result_t;
 
 #if defined(__cplusplus)
 extern "C" {
@@ -313,6 +518,18 @@ int mcp2221_find(int vid, int pid, wchar_t* manufacturer, wchar_t* product, wcha
 */
 int mcp2221_sameDevice(mcp2221_t* dev1, mcp2221_t* dev2);
 
+/**
+* @brief Enable or disable lazy opening
+*
+* Normally opening a device reads the descriptors, factory serial, versions and SRAM settings to fill in ::mcp2221_t.usbInfo.
+* With lazy opening enabled only the factory serial and SRAM settings are read (which gives the VID, PID, power source, remote wakeup and current limit),
+* the rest is read the first time mcp2221_getUSBInfo() is called. This makes opening a device quicker for programs that
+* don't need any of that. Applies to all of the mcp2221_open*() functions, disabled by default.
+*
+* @param [enable] 1 = Enable, 0 = Disable
+*/
+void mcp2221_setLazyOpen(int enable);
+
 /**
 * @brief Open first MCP2221 device found
 *
@@ -336,16 +553,165 @@ mcp2221_t* mcp2221_open_byIndex(int idx);
 */
 mcp2221_t* mcp2221_open_bySerial(wchar_t* serial);
 
+/**
+* @brief Open device by its factory serial (::mcp2221_usbinfo_t.factorySerial)
+*
+* The factory serial can only be read from an open device, so this only finds devices that have been opened
+* since the last call to mcp2221_find().
+*
+* @param [factorySerial] Factory serial
+* @return Device or NULL if not found
+*/
+mcp2221_t* mcp2221_open_byFactorySerial(const char* factorySerial);
+
+/**
+* @brief Create a context
+*
+* A context holds its own list of found devices, so different parts of a program can find and open devices
+* in parallel without getting in each other's way. The functions that don't take a context (mcp2221_find(),
+* mcp2221_open() etc) use a default context which is set up by mcp2221_init().
+* A context must only be used by one thread at a time. mcp2221_init() must still be called first.
+*
+* @return Context or NULL on failure
+*/
+mcp2221_ctx_t* mcp2221_ctxCreate(void);
+
+/**
+* @brief Destroy a context
+*
+* Devices opened from the context must be closed first.
+*
+* @param [ctx] Context to destroy
+* @return (none)
+*/
+void mcp2221_ctxDestroy(mcp2221_ctx_t* ctx);
+
+/**
+* @brief Same as mcp2221_find(), but using a context
+*
+* @param [ctx] Context to use
+* @param [vid] VID to match, 0 will match all VIDs
+* @param [pid] PID to match, 0 will match all PIDs
+* @param [manufacturer] Manufacturer to match, NULL will match all manufacturers
+* @param [product] Product to match, NULL will match all products
+* @param [serial] Serial to match, NULL will match all serials
+* @return Number of devices found
+*/
+int mcp2221_ctxFind(mcp2221_ctx_t* ctx, int vid, int pid, wchar_t* manufacturer, wchar_t* product, wchar_t* serial);
+
+/**
+* @brief Same as mcp2221_setLazyOpen(), but only for devices opened from a context
+*
+* @param [ctx] Context to use
+* @param [enable] 1 = Enable, 0 = Disable
+*/
+void mcp2221_ctxSetLazyOpen(mcp2221_ctx_t* ctx, int enable);
+
+/**
+* @brief Same as mcp2221_open(), but using a context
+*
+* @param [ctx] Context to use
+* @return Device or NULL on failure
+*/
+mcp2221_t* mcp2221_ctxOpen(mcp2221_ctx_t* ctx);
+
+/**
+* @brief Same as mcp2221_open_byIndex(), but using a context
+*
+* @param [ctx] Context to use
+* @param [idx] Index of the device
+* @return Device or NULL on failure
+*/
+mcp2221_t* mcp2221_ctxOpen_byIndex(mcp2221_ctx_t* ctx, int idx);
+
+/**
+* @brief Same as mcp2221_open_bySerial(), but using a context
+*
+* @param [ctx] Context to use
+* @param [serial] Serial
+* @return Device or NULL on failure
+*/
+mcp2221_t* mcp2221_ctxOpen_bySerial(mcp2221_ctx_t* ctx, wchar_t* serial);
+
+/**
+* @brief Same as mcp2221_open_byFactorySerial(), but using a context
+*
+* @param [ctx] Context to use
+* @param [factorySerial] Factory serial
+* @return Device or NULL on failure
+*/
+mcp2221_t* mcp2221_ctxOpen_byFactorySerial(mcp2221_ctx_t* ctx, const char* factorySerial);
+
+/**
+* @brief Open every device found by the last call to mcp2221_find()
+*
+* Devices are opened concurrently on a pool of threads, so the time taken is about the same as opening the slowest
+* device instead of adding up. Don't call mcp2221_find() until this has returned.
+*
+* @param [devices] Array of \p count devices, devices[i] is the device at index i or NULL if it couldn't be opened
+* @param [results] Array of \p count ::mcp2221_error error codes, why each device couldn't be opened. Can be NULL
+* @param [count] Number of devices, as returned by mcp2221_find()
+* @return ::MCP2221_SUCCESS if every device was opened, otherwise ::MCP2221_ERROR (see \p results for details)
+*/
+mcp2221_error mcp2221_openAll(mcp2221_t** devices, mcp2221_error* results, int count);
+
+/**
+* @brief Same as mcp2221_openAll(), but for the devices found by mcp2221_ctxFind()
+*
+* @param [ctx] Context to use
+* @param [devices] Array of \p count devices, devices[i] is the device at index i or NULL if it couldn't be opened
+* @param [results] Array of \p count ::mcp2221_error error codes, why each device couldn't be opened. Can be NULL
+* @param [count] Number of devices, as returned by mcp2221_ctxFind()
+* @return ::MCP2221_SUCCESS if every device was opened, otherwise ::MCP2221_ERROR (see \p results for details)
+*/
+mcp2221_error mcp2221_ctxOpenAll(mcp2221_ctx_t* ctx, mcp2221_t** devices, mcp2221_error* results, int count);
+
+/**
+* @brief Open a device through a custom transport backend
+*
+* @param [transport] Transport functions to use for this device
+* @param [handle] Handle passed to the transport functions, it is closed with \p transport->close if opening fails
+* @param [path] Path used to identify the physical device, can be NULL
+* @return Device or NULL on failure
+*/
+mcp2221_t* mcp2221_open_transport(const mcp2221_transport_t* transport, void* handle, const char* path);
+
+/**
+* @brief Open a software simulated MCP2221
+*
+* The simulator implements the commands used by this library and starts up with the default flash settings.
+* Each call creates a new independent simulated device.
+*
+* @return Device or NULL on failure
+*/
+mcp2221_t* mcp2221_open_sim(void);
+
 /**
 * @brief Close device
 *
+* If the I/O thread is running (see mcp2221_asyncStart()) then jobs that have already been submitted are run first.
+* When called from a job or completion callback the close is deferred, this returns straight away and the I/O thread closes the device
+* after the current job and the rest of the queue have finished. The device must not be used again after calling this either way.
+*
 * @return (none)
 */
 void mcp2221_close(mcp2221_t* device);
 
+/**
+* @brief Get the USB info of a device, reading the parts that a lazy open skipped if they haven't been read yet
+*
+* @param [device] Device to operate on
+* @param [info] Where to put the info
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_getUSBInfo(mcp2221_t* device, mcp2221_usbinfo_t* info);
+
 /**
 * @brief Perform a reset of the device
 *
+* The device doesn't send a response, it drops off the bus and comes back as a new USB device.
+* After this the device must be closed and found again with mcp2221_find().
+*
 * @param [device] Device to operate on
 * @return ::mcp2221_error error code
 */
@@ -362,12 +728,128 @@ mcp2221_error mcp2221_isConnected(mcp2221_t* device);
 /**
 * @brief Send a custom report, the response is placed in the same buffer
 *
+* The report is copied into a ::mcp2221_report_t and back again, use mcp2221_rawReportTimeout() to avoid the copies.
+*
 * @param [device] Device to operate on
 * @param [report] The report, should be an array with at least ::MCP2221_REPORT_SIZE elements
 * @return ::mcp2221_error error code
 */
 mcp2221_error mcp2221_rawReport(mcp2221_t* device, uint8_t* report);
 
+/**
+* @brief Send a custom report with a timeout for this call only, the response is placed in the same buffer
+*
+* @param [device] Device to operate on
+* @param [report] The report
+* @param [timeout] Milliseconds to wait for the response, ::MCP2221_TIMEOUT_ADAPTIVE or ::MCP2221_TIMEOUT_INFINITE
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_rawReportTimeout(mcp2221_t* device, mcp2221_report_t* report, int timeout);
+
+/**
+* @brief Send multiple custom reports, the responses are placed in the same buffers
+*
+* Several reports are kept in flight at once and the responses are matched to the reports by the echoed command byte.
+* This is much faster than calling mcp2221_rawReport() for each report since the USB round trips overlap.
+* The timeout applies to each response.
+* If any flash command response has a failed status then the rest are still collected and ::MCP2221_ERROR_STATUS is returned, check byte 1 of each response to see which.
+*
+* @param [device] Device to operate on
+* @param [reports] Array of \p count reports
+* @param [count] Number of reports
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_rawPipeline(mcp2221_t* device, mcp2221_report_t* reports, int count);
+
+/**
+* @brief Get a file descriptor which becomes readable when a response is waiting, for use with poll(), epoll, select() etc
+*
+* Only supported by the hidraw backend and the simulator (Linux/Mac).
+* Use mcp2221_submitReport() and mcp2221_completeReport() to talk to the device without blocking.
+*
+* @param [device] Device to operate on
+* @return File descriptor, or -1 if not supported
+*/
+int mcp2221_getPollFd(mcp2221_t* device);
+
+/**
+* @brief Send a custom report without waiting for the response
+*
+* The response must be collected with mcp2221_completeReport(). Responses come back in the same order as the reports were submitted.
+* Up to 32 reports can be waiting to be completed. Any other (blocking) call on the device gives up on them, their responses are thrown away.
+*
+* @param [device] Device to operate on
+* @param [report] The report
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_submitReport(mcp2221_t* device, mcp2221_report_t* report);
+
+/**
+* @brief Collect the response to a report sent with mcp2221_submitReport() without blocking
+*
+* Responses left over from earlier requests that timed out are skipped, like the blocking calls do.
+*
+* @param [device] Device to operate on
+* @param [report] Buffer to place the response into
+* @return ::mcp2221_error error code, ::MCP2221_ERROR_TIMEOUT if no response is waiting yet, ::MCP2221_ERROR_STATUS if the response to a flash command has a failed status,
+* ::MCP2221_ERROR if there's nothing to complete
+*/
+mcp2221_error mcp2221_completeReport(mcp2221_t* device, mcp2221_report_t* report);
+
+/**
+* @brief Get transport statistics
+*
+* Responses are matched to requests by their echoed command byte. Responses left over from requests that timed out are thrown away
+* when they eventually arrive, so a timeout doesn't knock every later response out of step.
+*
+* @param [device] Device to operate on
+* @param [stats] Where to place the statistics
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_getStats(mcp2221_t* device, mcp2221_stats_t* stats);
+
+/**
+* @brief Reset transport statistics to 0
+*
+* @param [device] Device to operate on
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_clearStats(mcp2221_t* device);
+
+/**
+* @brief Set how many times requests are retried after a HID error or timeout
+*
+* Only requests that just read something are retried (status, SRAM, GPIO and flash reads), anything that changes settings or
+* does I2C is never sent twice. The delay before each retry is doubled (up to 200ms) with some random jitter added.
+* The default is 2 retries with a 5ms backoff.
+*
+* @param [device] Device to operate on
+* @param [retries] Extra attempts, 0 to disable retrying
+* @param [backoff] Milliseconds to wait before the first retry
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_setRetry(mcp2221_t* device, int retries, int backoff);
+
+/**
+* @brief Set how long to wait for responses from the device
+*
+* The default is ::MCP2221_TIMEOUT_ADAPTIVE, which waits for a few times the measured round trip time (clamped to 50 - 5000ms).
+* If a call times out then its response may still arrive later.
+*
+* @param [device] Device to operate on
+* @param [timeout] Milliseconds, ::MCP2221_TIMEOUT_ADAPTIVE or ::MCP2221_TIMEOUT_INFINITE
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_setTimeout(mcp2221_t* device, int timeout);
+
+/**
+* @brief Get the timeout that will be used for the next call
+*
+* @param [device] Device to operate on
+* @return Timeout in milliseconds, ::MCP2221_TIMEOUT_INFINITE, or ::MCP2221_INVALID_ARG if \p device is NULL
+*/
+int mcp2221_getTimeout(mcp2221_t* device);
+
 /**
 * @brief TODO
 *
@@ -375,6 +857,51 @@ mcp2221_error mcp2221_rawReport(mcp2221_t* device, uint8_t* report);
 */
 mcp2221_gpioconfset_t mcp2221_GPIOConfInit(void);
 
+/**
+* @brief Enable or disable the SRAM cache
+*
+* A copy of the SRAM settings is read when the device is opened and kept up to date by the mcp2221_set* functions.
+* With the cache enabled the mcp2221_get* functions answer from this copy instead of asking the device.
+* Use mcp2221_refreshSRAM() if something else might have changed the settings, like another program or a reset.
+* Disabled by default.
+*
+* @param [device] Device to operate on
+* @param [enable] 1 = Enable, 0 = Disable
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_setSRAMCache(mcp2221_t* device, int enable);
+
+/**
+* @brief Enable or disable write suppression
+*
+* With write suppression enabled the SRAM setting and GPIO output functions (mcp2221_set*, mcp2221_SRAMUpdateSend())
+* compare the new settings against the SRAM cache and don't send anything that the device already has.
+* If none of the settings would change then the function returns straight away without any USB traffic.
+* Only use this if nothing else changes the device's settings, or call mcp2221_refreshSRAM() when something might have.
+* Disabled by default.
+*
+* @param [device] Device to operate on
+* @param [enable] 1 = Enable, 0 = Disable
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_setWriteSuppression(mcp2221_t* device, int enable);
+
+/**
+* @brief Read the SRAM settings from the device into the cache
+*
+* @param [device] Device to operate on
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_refreshSRAM(mcp2221_t* device);
+
+/**
+* @brief Get the SRAM cache generation, this is incremented whenever the cached settings change
+*
+* @param [device] Device to operate on
+* @return Generation, 0 if \p device is NULL
+*/
+uint32_t mcp2221_getSRAMGeneration(mcp2221_t* device);
+
 /**
 * @brief Set the clock reference output divider and duty cycle (SRAM)
 *
@@ -423,6 +950,78 @@ mcp2221_error mcp2221_setInterrupt(mcp2221_t* device, mcp2221_int_trig_t trig, i
 */
 mcp2221_error mcp2221_setGPIOConf(mcp2221_t* device, mcp2221_gpioconfset_t* confSet);
 
+/**
+* @brief Start a staged SRAM update
+*
+* Clock output, DAC, ADC, interrupt and GPIO changes can be added with the mcp2221_SRAMUpdate* functions,
+* then mcp2221_SRAMUpdateSend() sends them all to the device in a single report so they take effect at the same time.
+*
+* @return ::mcp2221_sramupdate_t with nothing changed
+*/
+mcp2221_sramupdate_t mcp2221_SRAMUpdateInit(void);
+
+/**
+* @brief Add clock reference output divider and duty cycle to a staged SRAM update, see mcp2221_setClockOut()
+*
+* @param [update] Update to add to
+* @param [div] Frequency divider from 48MHz
+* @param [duty] Duty cycle
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_SRAMUpdateClockOut(mcp2221_sramupdate_t* update, mcp2221_clkdiv_t div, mcp2221_clkduty_t duty);
+
+/**
+* @brief Add DAC reference and output value to a staged SRAM update, see mcp2221_setDAC()
+*
+* @param [update] Update to add to
+* @param [ref] Voltage reference
+* @param [value] Output value, between 0 and ::MCP2221_DAC_MAX
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_SRAMUpdateDAC(mcp2221_sramupdate_t* update, mcp2221_dac_ref_t ref, int value);
+
+/**
+* @brief Add ADC reference to a staged SRAM update, see mcp2221_setADC()
+*
+* @param [update] Update to add to
+* @param [ref] Voltage reference
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_SRAMUpdateADC(mcp2221_sramupdate_t* update, mcp2221_adc_ref_t ref);
+
+/**
+* @brief Add interrupt trigger mode to a staged SRAM update, see mcp2221_setInterrupt()
+*
+* @param [update] Update to add to
+* @param [trig] Trigger mode
+* @param [clearInt] Clear pending interrupt (0 = Don't clear, 1 = Clear)
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_SRAMUpdateInterrupt(mcp2221_sramupdate_t* update, mcp2221_int_trig_t trig, int clearInt);
+
+/**
+* @brief Add GPIO configuration to a staged SRAM update, see mcp2221_setGPIOConf()
+*
+* All GPIOs have to be sent together, so pins not in \p confSet keep their current configuration.
+*
+* @param [device] Device the update will be sent to
+* @param [update] Update to add to
+* @param [confSet] Pointer to ::mcp2221_gpioconfset_t struct
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_SRAMUpdateGPIOConf(mcp2221_t* device, mcp2221_sramupdate_t* update, mcp2221_gpioconfset_t* confSet);
+
+/**
+* @brief Send a staged SRAM update to the device
+*
+* \p update is overwritten by the response, start a new one with mcp2221_SRAMUpdateInit() for further changes.
+*
+* @param [device] Device to operate on
+* @param [update] Update to send
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_SRAMUpdateSend(mcp2221_t* device, mcp2221_sramupdate_t* update);
+
 /**
 * @brief Set GPIO pin output values
 *
@@ -433,6 +1032,19 @@ mcp2221_error mcp2221_setGPIOConf(mcp2221_t* device, mcp2221_gpioconfset_t* conf
 */
 mcp2221_error mcp2221_setGPIO(mcp2221_t* device, mcp2221_gpio_t pins, mcp2221_gpio_value_t value);
 
+/**
+* @brief Set the output values of several GPIO pins at once
+*
+* All pins are changed by a single report, so they change at the same time.
+* For example, GPIO0 high and GPIO1 low: mcp2221_setGPIOValues(device, MCP2221_GPIO0 | MCP2221_GPIO1, MCP2221_GPIO0)
+*
+* @param [device] Device to operate on
+* @param [pins] Which GPIO pins to change (::mcp2221_gpio_t values OR'd together)
+* @param [values] New values, pins with their bit set go high and the others go low
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_setGPIOValues(mcp2221_t* device, int pins, int values);
+
 /**
 * @brief Get the current clock output divider (SRAM)
 *
@@ -498,6 +1110,17 @@ mcp2221_error mcp2221_readADC(mcp2221_t* device, int values[MCP2221_ADC_COUNT]);
 */
 mcp2221_error mcp2221_readInterrupt(mcp2221_t* device, int* state);
 
+/**
+* @brief Read ADC values, interrupt state, I2C state and pins, and firmware and hardware versions all at once
+*
+* Does the same as mcp2221_readADC(), mcp2221_readInterrupt(), mcp2221_i2cState() and mcp2221_i2cReadPins() but with only 1 USB transaction.
+*
+* @param [device] Device to operate on
+* @param [status] Pointer to struct where the values will be placed
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_readStatus(mcp2221_t* device, mcp2221_status_t* status);
+
 /**
 * @brief Clear interrupt state
 *
@@ -515,6 +1138,145 @@ mcp2221_error mcp2221_clearInterrupt(mcp2221_t* device);
 */
 mcp2221_error mcp2221_readGPIO(mcp2221_t* device, mcp2221_gpio_value_t values[MCP2221_GPIO_COUNT]);
 
+/**
+* @brief Enable or disable the flash cache
+*
+* With the flash cache enabled the first mcp2221_load*() or mcp2221_save*() call reads all of the flash sections in one go
+* (pipelined, see mcp2221_rawPipeline()) and after that the mcp2221_load*() functions don't do any USB transactions.
+* Flash writes made by this library update the cache.
+* Only use this if nothing else changes the device's flash, or call mcp2221_invalidateFlash() or mcp2221_refreshFlash() when something might have.
+* Disabled by default.
+*
+* @param [device] Device to operate on
+* @param [enable] 1 = Enable, 0 = Disable
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_setFlashCache(mcp2221_t* device, int enable);
+
+/**
+* @brief Read all of the flash sections into the flash cache now
+*
+* @param [device] Device to operate on
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_refreshFlash(mcp2221_t* device);
+
+/**
+* @brief Forget the flash cache contents, they'll be read again the next time they're needed
+*
+* Changes waiting for mcp2221_flashCommit() are kept.
+*
+* @param [device] Device to operate on
+*/
+void mcp2221_invalidateFlash(mcp2221_t* device);
+
+/**
+* @brief Start a flash edit session
+*
+* Each mcp2221_save*() function normally reads the flash section it changes and writes the whole section back,
+* so changing several settings means a read and a write for each one.
+* While a session is open the mcp2221_save*() and mcp2221_load*() functions only read each section from the device once,
+* and changes are kept in memory until mcp2221_flashCommit() writes each changed section once.
+* This saves USB round trips and flash write cycles when provisioning devices.
+*
+* @param [device] Device to operate on
+* @return ::mcp2221_error error code, ::MCP2221_ERROR if a session is already open
+*/
+mcp2221_error mcp2221_flashBegin(mcp2221_t* device);
+
+/**
+* @brief Write the flash sections changed since mcp2221_flashBegin() and end the session
+*
+* The chip settings section is written last since it can turn on password protection.
+* If a write fails then the session stays open with the sections that haven't been written yet,
+* call this again to retry or mcp2221_flashCancel() to give up on them.
+*
+* @param [device] Device to operate on
+* @return ::mcp2221_error error code, ::MCP2221_ERROR if there's no session open
+*/
+mcp2221_error mcp2221_flashCommit(mcp2221_t* device);
+
+/**
+* @brief End a flash edit session without writing anything
+*
+* @param [device] Device to operate on
+*/
+void mcp2221_flashCancel(mcp2221_t* device);
+
+/**
+* @brief Capture the SRAM settings and all flash sections of a device
+*
+* Everything is read with one pipeline (see mcp2221_rawPipeline()).
+* This also refreshes the SRAM cache, and the flash cache if it's enabled.
+*
+* @param [device] Device to operate on
+* @param [snapshot] Where to put the snapshot
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_snapshotTake(mcp2221_t* device, mcp2221_snapshot_t* snapshot);
+
+/**
+* @brief Compare two snapshots
+*
+* Only the bytes of each part that hold settings are compared.
+*
+* @param [snapshot1] First snapshot
+* @param [snapshot2] Second snapshot
+* @return ::mcp2221_snapshot_part_t bits for each part that's different, or ::MCP2221_INVALID_ARG if either snapshot isn't valid
+*/
+int mcp2221_snapshotDiff(const mcp2221_snapshot_t* snapshot1, const mcp2221_snapshot_t* snapshot2);
+
+/**
+* @brief Write parts of a snapshot to a device
+*
+* Each flash section is written with a single WRITEFLASH report and the SRAM settings with a single SETSRAM report.
+* To only write what's needed pass the result of mcp2221_snapshotDiff() against a snapshot of the device.
+* Flash writes join the flash edit session if one is open (see mcp2221_flashBegin()).
+* Snapshots don't hold the flash password, so applying chip settings with password protection on needs the password to be
+* given first with mcp2221_unlockFlash() or mcp2221_savePassword().
+*
+* @param [device] Device to operate on
+* @param [snapshot] Snapshot to apply
+* @param [parts] ::mcp2221_snapshot_part_t bits for the parts to write
+* @return ::mcp2221_error error code, ::MCP2221_INVALID_ARG if the snapshot isn't valid or it has password protection on and no password has been given
+*/
+mcp2221_error mcp2221_snapshotApply(mcp2221_t* device, const mcp2221_snapshot_t* snapshot, int parts);
+
+/**
+* @brief Send the flash access password to a password protected device
+*
+* The device accepts flash writes until it's reset or unplugged. The password is remembered so calling this again with
+* the same password (for example before each batch of mcp2221_save*() calls) doesn't send anything.
+* The MCP2221 stops accepting passwords until it's power cycled after 3 wrong attempts.
+*
+* @param [device] Device to operate on
+* @param [password] ::MCP2221_PASSWORD_LEN byte password
+* @return ::mcp2221_error error code, ::MCP2221_ERROR_ACCESS if the password was rejected
+*/
+mcp2221_error mcp2221_unlockFlash(mcp2221_t* device, const uint8_t password[MCP2221_PASSWORD_LEN]);
+
+/**
+* @brief Turn on flash password protection with a new password, or turn it off
+*
+* If password protection is already on then the device must be unlocked first with mcp2221_unlockFlash().
+* The new password is used by this library straight away, even if the write is waiting in a flash edit session.
+* When turning protection on, call mcp2221_unlockFlash() with the new password before writing anything else to flash.
+*
+* @param [device] Device to operate on
+* @param [password] New ::MCP2221_PASSWORD_LEN byte password, or NULL to turn off password protection
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_savePassword(mcp2221_t* device, const uint8_t password[MCP2221_PASSWORD_LEN]);
+
+/**
+* @brief Load the flash security setting
+*
+* @param [device] Device to operate on
+* @param [security] Pointer to variable to place security setting
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_loadSecurity(mcp2221_t* device, mcp2221_security_t* security);
+
 /**
 * @brief Save new manufacturer USB descriptor string to flash (max 30 characters)
 *
@@ -849,6 +1611,260 @@ mcp2221_error mcp2221_i2cDivider(mcp2221_t* device, int i2cdiv);
 */
 mcp2221_error mcp2221_i2cReadPins(mcp2221_t* device, mcp2221_i2cpins_t* pins);
 
+/**
+* @brief Start the I/O thread for a device
+*
+* Once started, jobs submitted with mcp2221_asyncSubmit() are run one at a time in the order they were submitted.
+* The device should then only be used from inside jobs, the library functions are not thread-safe.
+*
+* @param [device] Device to operate on
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_asyncStart(mcp2221_t* device);
+
+/**
+* @brief Stop the I/O thread for a device, jobs that have already been submitted are run first
+*
+* This is also done by mcp2221_close()
+*
+* Can be called from a job or completion callback, in which case this doesn't wait for the thread to exit.
+* The thread stops once the queue is empty and is cleaned up by the next call to mcp2221_asyncStop(), mcp2221_asyncStart() or mcp2221_close()
+* from another thread, which is safe to do at any time.
+*
+* @param [device] Device to operate on
+* @return (none)
+*/
+void mcp2221_asyncStop(mcp2221_t* device);
+
+/**
+* @brief Queue up a job to run on the I/O thread of a device
+*
+* The job can call any of the normal library functions, for example a job which calls mcp2221_readADC() is an asynchronous ADC read.
+*
+* @param [device] Device to operate on, mcp2221_asyncStart() must have been called
+* @param [job] Function to run
+* @param [arg] Passed to \p job
+* @param [callback] Called once the job has finished, can be NULL
+* @param [userData] Passed to \p callback
+* @param [request] Where to place the request handle, which must then be passed to mcp2221_asyncWait(). If NULL then the request is cleaned up by itself after it has finished
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_asyncSubmit(mcp2221_t* device, mcp2221_job_t job, void* arg, mcp2221_callback_t callback, void* userData, mcp2221_request_t** request);
+
+/**
+* @brief Wait for a request to finish and free it
+*
+* @param [request] Request handle from mcp2221_asyncSubmit()
+* @return ::mcp2221_error error code returned by the job
+*/
+mcp2221_error mcp2221_asyncWait(mcp2221_request_t* request);
+
+/**
+* @brief Create an engine for driving many devices from one thread
+*
+* On Linux devices opened with the hidraw backend (make HIDRAW=1) are driven through io_uring, so the reports for every device
+* are sent and received with a single system call. Devices using other backends are still supported but their requests
+* are done one at a time in mcp2221_engineSubmit(), as are all devices if io_uring isn't available.
+*
+* @param [maxRequests] Maximum number of requests in flight, usually the number of devices
+* @return Engine or NULL on failure
+*/
+mcp2221_engine_t* mcp2221_engineCreate(int maxRequests);
+
+/**
+* @brief Destroy an engine, waiting for any requests still in flight
+*
+* @param [engine] Engine to destroy
+* @return (none)
+*/
+void mcp2221_engineDestroy(mcp2221_engine_t* engine);
+
+/**
+* @brief Queue up a custom report for a device
+*
+* Only one request per device can be in flight at a time. The report is sent by the next call to mcp2221_engineRun().
+*
+* @param [engine] Engine to use
+* @param [device] Device to send the report to
+* @param [report] The report, the response is placed in the same buffer. Must stay valid until the callback has been called
+* @param [callback] Called from mcp2221_engineRun() once the response has arrived, can be NULL
+* @param [userData] Passed to \p callback
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_engineSubmit(mcp2221_engine_t* engine, mcp2221_t* device, mcp2221_report_t* report, mcp2221_engine_callback_t callback, void* userData);
+
+/**
+* @brief Send queued reports and call callbacks for any requests that have finished
+*
+* @param [engine] Engine to use
+* @param [wait] 1 = Wait until at least one request has finished (if any are in flight), 0 = Don't wait
+* @return Number of finished requests or ::mcp2221_error error code
+*/
+int mcp2221_engineRun(mcp2221_engine_t* engine, int wait);
+
+/**
+* @brief Create a hot-plug monitor (Linux only)
+*
+* The monitor keeps the list of devices from mcp2221_find() up to date as devices are plugged in and unplugged, without
+* enumerating everything again. Call mcp2221_find() first to get the devices that are already attached.
+* Indexes of unplugged devices aren't given to other devices, so mcp2221_open_byIndex() keeps working for the rest.
+* A device that gets plugged back in gets a new index, even if it ends up with the same path.
+* Only devices using hidraw (make HIDRAW=1, or HIDAPI's hidraw backend) can be tracked.
+*
+* @param [vid] VID to match, 0 will match all VIDs
+* @param [pid] PID to match, 0 will match all PIDs
+* @param [attached] Called when a matching device is plugged in, can be NULL
+* @param [detached] Called when a device is unplugged, can be NULL
+* @param [userData] Passed to the callbacks
+* @return Monitor or NULL on failure
+*/
+mcp2221_monitor_t* mcp2221_monitorCreate(int vid, int pid, mcp2221_hotplug_t attached, mcp2221_hotplug_t detached, void* userData);
+
+/**
+* @brief Same as mcp2221_monitorCreate(), but keeps the list of devices in a context up to date
+*
+* @param [ctx] Context to use
+* @param [vid] VID to match, 0 will match all VIDs
+* @param [pid] PID to match, 0 will match all PIDs
+* @param [attached] Called when a matching device is plugged in, can be NULL
+* @param [detached] Called when a device is unplugged, can be NULL
+* @param [userData] Passed to the callbacks
+* @return Monitor or NULL on failure
+*/
+mcp2221_monitor_t* mcp2221_ctxMonitorCreate(mcp2221_ctx_t* ctx, int vid, int pid, mcp2221_hotplug_t attached, mcp2221_hotplug_t detached, void* userData);
+
+/**
+* @brief Destroy a hot-plug monitor
+*
+* @param [monitor] Monitor to destroy
+* @return (none)
+*/
+void mcp2221_monitorDestroy(mcp2221_monitor_t* monitor);
+
+/**
+* @brief Get a file descriptor that becomes readable when mcp2221_monitorRun() has events to process
+*
+* For adding the monitor to a poll()/select()/epoll loop.
+*
+* @param [monitor] Monitor to use
+* @return File descriptor or -1
+*/
+int mcp2221_monitorGetFd(mcp2221_monitor_t* monitor);
+
+/**
+* @brief Process hot-plug events, calling the callbacks for any devices that were plugged in or unplugged
+*
+* The first call also picks up anything that changed between mcp2221_find() and mcp2221_monitorCreate().
+*
+* @param [monitor] Monitor to use
+* @param [timeout] How long to wait for an event (ms), 0 = Don't wait, -1 = Wait forever
+* @return Number of devices plugged in or unplugged or ::mcp2221_error error code
+*/
+int mcp2221_monitorRun(mcp2221_monitor_t* monitor, int timeout);
+
+/**
+* @brief Create an empty profile, set ::mcp2221_profile_t.fields for each setting that's filled in
+*
+* @return ::mcp2221_profile_t
+*/
+mcp2221_profile_t mcp2221_profileInit(void);
+
+/**
+* @brief Apply a profile to a device
+*
+* All of the flash sections are read once in a single pipeline, only the sections with settings that are different
+* from the profile are written, and if anything was written then the flash is read back and checked.
+*
+* @param [device] Device to operate on
+* @param [profile] Settings to apply
+* @param [result] Where to put the result, can be NULL
+* @return ::mcp2221_error error code, ::MCP2221_ERROR_VERIFY if the readback didn't match the profile
+*/
+mcp2221_error mcp2221_provision(mcp2221_t* device, const mcp2221_profile_t* profile, mcp2221_provision_result_t* result);
+
+/**
+* @brief Apply a profile to every device found by the last call to mcp2221_find()
+*
+* Devices are opened and provisioned concurrently with mcp2221_provision(), so the time taken stays about the same
+* no matter how many devices there are. Don't call mcp2221_find() until this has returned.
+*
+* @param [profile] Settings to apply
+* @param [results] Array of \p count results, results[i] is for the device at index i
+* @param [count] Number of devices, as returned by mcp2221_find()
+* @return ::MCP2221_SUCCESS if every device was provisioned, otherwise ::MCP2221_ERROR (see \p results for details)
+*/
+mcp2221_error mcp2221_provisionAll(const mcp2221_profile_t* profile, mcp2221_provision_result_t* results, int count);
+
+/**
+* @brief Same as mcp2221_provisionAll(), but for the devices found by mcp2221_ctxFind()
+*
+* @param [ctx] Context to use
+* @param [profile] Settings to apply
+* @param [results] Array of \p count results, results[i] is for the device at index i
+* @param [count] Number of devices, as returned by mcp2221_ctxFind()
+* @return ::MCP2221_SUCCESS if every device was provisioned, otherwise ::MCP2221_ERROR (see \p results for details)
+*/
+mcp2221_error mcp2221_ctxProvisionAll(mcp2221_ctx_t* ctx, const mcp2221_profile_t* profile, mcp2221_provision_result_t* results, int count);
+
+/**
+* @brief Simulated I2C slave write handler
+*
+* @param [userData] Pointer passed to mcp2221_simAddI2CSlave()
+* @param [data] Data written by the master
+* @param [len] Number of bytes written
+* @return 0 to ACK, anything else to NACK
+*/
+typedef int (*mcp2221_sim_i2cwrite_t)(void* userData, const uint8_t* data, int len);
+
+/**
+* @brief Simulated I2C slave read handler
+*
+* @param [userData] Pointer passed to mcp2221_simAddI2CSlave()
+* @param [data] Buffer to place data into
+* @param [len] Number of bytes requested by the master
+* @return 0 to ACK, anything else to NACK
+*/
+typedef int (*mcp2221_sim_i2cread_t)(void* userData, uint8_t* data, int len);
+
+/**
+* @brief Attach a virtual I2C slave to a simulated device
+*
+* @param [device] Device opened with mcp2221_open_sim()
+* @param [address] I2C slave address (7 bit addresses only)
+* @param [writeFunc] Called when the master writes to this address, can be NULL
+* @param [readFunc] Called when the master reads from this address, can be NULL
+* @param [userData] Passed to the handlers
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_simAddI2CSlave(mcp2221_t* device, int address, mcp2221_sim_i2cwrite_t writeFunc, mcp2221_sim_i2cread_t readFunc, void* userData);
+
+/**
+* @brief Set the values returned by the ADCs of a simulated device
+*
+* @param [device] Device opened with mcp2221_open_sim()
+* @param [values] Int array of ::MCP2221_ADC_COUNT elements (0 - 1023)
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_simSetADC(mcp2221_t* device, int values[MCP2221_ADC_COUNT]);
+
+/**
+* @brief Set the level seen by GPIO pins that are configured as inputs on a simulated device
+*
+* @param [device] Device opened with mcp2221_open_sim()
+* @param [pins] Which GPIO pins should the new value be applied to
+* @param [value] The new value
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_simSetInput(mcp2221_t* device, mcp2221_gpio_t pins, mcp2221_gpio_value_t value);
+
+/**
+* @brief Set the interrupt flag of a simulated device, as if an edge was detected
+*
+* @param [device] Device opened with mcp2221_open_sim()
+* @return ::mcp2221_error error code
+*/
+mcp2221_error mcp2221_simTriggerInterrupt(mcp2221_t* device);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,243 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Asynchronous requests, each device gets its own I/O thread which runs submitted jobs in order
+
+#include <stdlib.h>
+#include "libmcp2221.h"
+#include "internal.h"
+#include "thread.h"
+
+struct mcp2221_request_t{
+	mcp2221_request_t* next;
+	mcp2221_job_t job;
+	void* arg;
+	mcp2221_callback_t callback;
+	void* userData;
+	mcp2221_error result;
+	int detached;		// Nobody will wait for this request, free it once it's done
+	signal_t done;
+};
+
+typedef struct{
+	mcp2221_t* device;
+	thread_t thread;
+	mutex_t lock;
+	signal_t pending;	// Posted once for each queued request
+	mcp2221_request_t* head;
+	mcp2221_request_t* tail;
+	int stopping;
+	int closeDevice;	// mcp2221_close() was called from one of its own jobs or callbacks, close the device once stopped
+}async_t;
+
+static void freeRequest(mcp2221_request_t* request)
+{
+	signalDestroy(&request->done);
+	free(request);
+}
+
+static void freeAsync(async_t* async)
+{
+	async->device->priv->async = NULL;
+	signalDestroy(&async->pending);
+	mutexDestroy(&async->lock);
+	free(async);
+}
+
+// Let the thread finish whatever is queued up, it exits once it finds the queue empty
+static void requestStop(async_t* async)
+{
+	mutexLock(&async->lock);
+	async->stopping = 1;
+	mutexUnlock(&async->lock);
+	signalPost(&async->pending);
+}
+
+static void ioThread(void* arg)
+{
+	async_t* async = arg;
+
+	while(1)
+	{
+		signalWait(&async->pending);
+
+		mutexLock(&async->lock);
+		mcp2221_request_t* request = async->head;
+		if(request)
+		{
+			async->head = request->next;
+			if(!async->head)
+				async->tail = NULL;
+		}
+		mutexUnlock(&async->lock);
+
+		if(!request) // Woken up by mcp2221_asyncStop() and the queue is empty
+			break;
+
+		request->result = request->job(async->device, request->arg);
+
+		if(request->callback)
+			request->callback(async->device, request->result, request->userData);
+
+		if(request->detached)
+			freeRequest(request);
+		else
+			signalPost(&request->done);
+	}
+
+	// Normally whoever stops the thread joins it and frees everything, but after a deferred close nobody else
+	// is allowed to touch the device so the thread cleans up after itself
+	mutexLock(&async->lock);
+	int closeDevice = async->closeDevice;
+	mutexUnlock(&async->lock);
+	if(closeDevice)
+	{
+		mcp2221_t* device = async->device;
+		threadDetach(&async->thread);
+		freeAsync(async);
+		mcp2221_close(device);
+	}
+}
+
+// Wait for a stopped thread to exit and free it
+static void joinAsync(async_t* async)
+{
+	threadJoin(&async->thread);
+	freeAsync(async);
+}
+
+int asyncDeferClose(mcp2221_t* device)
+{
+	async_t* async = device->priv->async;
+	if(!async || !threadIsCurrent(&async->thread))
+		return 0;
+
+	// The job or callback that called mcp2221_close() is still using the device
+	mutexLock(&async->lock);
+	async->closeDevice = 1;
+	mutexUnlock(&async->lock);
+	requestStop(async);
+	return 1;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_asyncStart(mcp2221_t* device)
+{
+	if(!device)
+		return MCP2221_INVALID_ARG;
+
+	async_t* async = device->priv->async;
+	if(async)
+	{
+		mutexLock(&async->lock);
+		int stopping = async->stopping;
+		mutexUnlock(&async->lock);
+
+		if(!stopping) // Already running
+			return MCP2221_SUCCESS;
+		else if(threadIsCurrent(&async->thread)) // Stopped from this job or callback and can't be joined from here
+			return MCP2221_ERROR;
+
+		// Stopped from one of its own jobs, get rid of the old thread first
+		joinAsync(async);
+	}
+
+	async = calloc(1, sizeof(async_t));
+	if(!async)
+		return MCP2221_ERROR;
+
+	async->device = device;
+	mutexInit(&async->lock);
+	signalInit(&async->pending);
+
+	if(!threadCreate(&async->thread, ioThread, async))
+	{
+		signalDestroy(&async->pending);
+		mutexDestroy(&async->lock);
+		free(async);
+		return MCP2221_ERROR;
+	}
+
+	device->priv->async = async;
+
+	return MCP2221_SUCCESS;
+}
+
+void LIB_EXPORT mcp2221_asyncStop(mcp2221_t* device)
+{
+	if(!device || !device->priv->async)
+		return;
+
+	async_t* async = device->priv->async;
+
+	requestStop(async);
+
+	// Called from a job or callback, joining would wait forever
+	// The thread exits once the queue is empty and is joined by the next mcp2221_asyncStop(), mcp2221_asyncStart() or mcp2221_close()
+	if(threadIsCurrent(&async->thread))
+		return;
+
+	joinAsync(async);
+}
+
+mcp2221_error LIB_EXPORT mcp2221_asyncSubmit(mcp2221_t* device, mcp2221_job_t job, void* arg, mcp2221_callback_t callback, void* userData, mcp2221_request_t** request)
+{
+	if(request)
+		*request = NULL;
+
+	if(!device || !job)
+		return MCP2221_INVALID_ARG;
+	else if(!device->priv->async)
+		return MCP2221_ERROR;
+
+	async_t* async = device->priv->async;
+
+	mcp2221_request_t* req = calloc(1, sizeof(mcp2221_request_t));
+	if(!req)
+		return MCP2221_ERROR;
+
+	req->job = job;
+	req->arg = arg;
+	req->callback = callback;
+	req->userData = userData;
+	req->detached = (request == NULL);
+	signalInit(&req->done);
+
+	mutexLock(&async->lock);
+	if(async->stopping)
+	{
+		mutexUnlock(&async->lock);
+		freeRequest(req);
+		return MCP2221_ERROR;
+	}
+
+	if(async->tail)
+		async->tail->next = req;
+	else
+		async->head = req;
+	async->tail = req;
+	mutexUnlock(&async->lock);
+
+	if(request)
+		*request = req;
+
+	signalPost(&async->pending);
+
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_asyncWait(mcp2221_request_t* request)
+{
+	if(!request)
+		return MCP2221_INVALID_ARG;
+
+	signalWait(&request->done);
+
+	mcp2221_error res = request->result;
+	freeRequest(request);
+	return res;
+}
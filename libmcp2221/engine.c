@@ -0,0 +1,509 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Engine for driving lots of devices from one thread
+// On Linux, devices opened with the hidraw backend are driven through io_uring: each request is a
+// write -> read -> timeout chain, and every chain that's waiting is submitted with a single syscall.
+// Anything else (HIDAPI, simulator, other OSes, or a kernel without io_uring) falls back to normal blocking transactions.
+
+#if defined(__linux__) && defined(__has_include)
+	#if __has_include(<linux/io_uring.h>)
+		#define ENGINE_IO_URING 1
+	#endif
+#endif
+
+#ifdef ENGINE_IO_URING
+	#define _DEFAULT_SOURCE
+	#include <errno.h>
+	#include <unistd.h>
+	#include <poll.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <linux/io_uring.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "libmcp2221.h"
+#include "internal.h"
+
+// Lower bits of the io_uring user_data say which part of the chain completed
+#define TAG_WRITE	0
+#define TAG_READ	1
+#define TAG_TIMEOUT	2
+#define TAG_POLL	3
+#define TAG_MASK	3
+
+typedef struct engine_req_t engine_req_t;
+struct engine_req_t{
+	engine_req_t* next;		// Free list or done list
+	mcp2221_t* device;
+	mcp2221_report_t* report;
+	mcp2221_engine_callback_t callback;
+	void* userData;
+	mcp2221_error result;
+#ifdef ENGINE_IO_URING
+	struct __kernel_timespec ts;
+	uint64_t start;					// When the request was submitted, for the round trip time
+	int fd;
+	int cqes;						// Completions still to come before this request can be finished
+	int written;
+	int stale;						// Skipped over a stale response
+	int sameType;					// Last stale response was the same type as ours, so it might have been ours
+	uint8_t type;
+#endif
+};
+
+struct mcp2221_engine_t{
+	engine_req_t* reqs;
+	engine_req_t* freeList;
+	engine_req_t* doneHead;
+	engine_req_t* doneTail;
+	int inFlight;
+#ifdef ENGINE_IO_URING
+	int ringFd;
+	void* sqPtr;
+	void* cqPtr;
+	size_t sqSize;
+	size_t cqSize;
+	struct io_uring_sqe* sqes;
+	size_t sqesSize;
+	unsigned int* sqHead;
+	unsigned int* sqTail;
+	unsigned int* sqMask;
+	unsigned int* sqEntries;
+	unsigned int* sqArray;
+	unsigned int* cqHead;
+	unsigned int* cqTail;
+	unsigned int* cqMask;
+	struct io_uring_cqe* cqes;
+	unsigned int localTail;	// SQEs prepared up to here
+	unsigned int toSubmit;	// SQEs prepared but not yet handed to the kernel
+#endif
+};
+
+static void finishRequest(mcp2221_engine_t* engine, engine_req_t* req)
+{
+	req->next = NULL;
+	if(engine->doneTail)
+		engine->doneTail->next = req;
+	else
+		engine->doneHead = req;
+	engine->doneTail = req;
+}
+
+#ifdef ENGINE_IO_URING
+
+static int ringSetup(mcp2221_engine_t* engine, unsigned int entries)
+{
+	struct io_uring_params params;
+	memset(&params, 0x00, sizeof(params));
+
+	engine->ringFd = syscall(__NR_io_uring_setup, entries, &params);
+	if(engine->ringFd < 0)
+		return 0;
+
+	engine->sqSize = params.sq_off.array + (params.sq_entries * sizeof(unsigned int));
+	engine->cqSize = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+
+	int single = params.features & IORING_FEAT_SINGLE_MMAP;
+	if(single)
+	{
+		if(engine->cqSize > engine->sqSize)
+			engine->sqSize = engine->cqSize;
+		engine->cqSize = engine->sqSize;
+	}
+
+	engine->sqPtr = mmap(NULL, engine->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, engine->ringFd, IORING_OFF_SQ_RING);
+	if(engine->sqPtr == MAP_FAILED)
+		return 0;
+
+	if(single)
+		engine->cqPtr = engine->sqPtr;
+	else
+	{
+		engine->cqPtr = mmap(NULL, engine->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, engine->ringFd, IORING_OFF_CQ_RING);
+		if(engine->cqPtr == MAP_FAILED)
+		{
+			engine->cqPtr = NULL;
+			return 0;
+		}
+	}
+
+	engine->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	engine->sqes = mmap(NULL, engine->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, engine->ringFd, IORING_OFF_SQES);
+	if(engine->sqes == MAP_FAILED)
+	{
+		engine->sqes = NULL;
+		return 0;
+	}
+
+	uint8_t* sq = engine->sqPtr;
+	engine->sqHead = (unsigned int*)(sq + params.sq_off.head);
+	engine->sqTail = (unsigned int*)(sq + params.sq_off.tail);
+	engine->sqMask = (unsigned int*)(sq + params.sq_off.ring_mask);
+	engine->sqEntries = (unsigned int*)(sq + params.sq_off.ring_entries);
+	engine->sqArray = (unsigned int*)(sq + params.sq_off.array);
+	engine->localTail = *engine->sqTail;
+
+	uint8_t* cq = engine->cqPtr;
+	engine->cqHead = (unsigned int*)(cq + params.cq_off.head);
+	engine->cqTail = (unsigned int*)(cq + params.cq_off.tail);
+	engine->cqMask = (unsigned int*)(cq + params.cq_off.ring_mask);
+	engine->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	return 1;
+}
+
+static void ringFree(mcp2221_engine_t* engine)
+{
+	if(engine->sqes)
+		munmap(engine->sqes, engine->sqesSize);
+	if(engine->cqPtr && engine->cqPtr != engine->sqPtr)
+		munmap(engine->cqPtr, engine->cqSize);
+	if(engine->sqPtr && engine->sqPtr != MAP_FAILED)
+		munmap(engine->sqPtr, engine->sqSize);
+	if(engine->ringFd >= 0)
+		close(engine->ringFd);
+
+	engine->sqes = NULL;
+	engine->cqPtr = NULL;
+	engine->sqPtr = NULL;
+	engine->ringFd = -1;
+}
+
+static int ringEnter(mcp2221_engine_t* engine, unsigned int minComplete)
+{
+	// Make the prepared SQEs visible to the kernel
+	__atomic_store_n(engine->sqTail, engine->localTail, __ATOMIC_RELEASE);
+
+	int res;
+	while((res = syscall(__NR_io_uring_enter, engine->ringFd, engine->toSubmit, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0, NULL, 0)) < 0 && errno == EINTR);
+
+	if(res > 0)
+		engine->toSubmit -= res;
+	return res;
+}
+
+// Make sure there's room for a few more SQEs, so a chain never gets split up
+static int reserveSqes(mcp2221_engine_t* engine, unsigned int count)
+{
+	unsigned int head = __atomic_load_n(engine->sqHead, __ATOMIC_ACQUIRE);
+	if(*engine->sqEntries - (engine->localTail - head) >= count)
+		return 1;
+
+	// Full, hand what we've got to the kernel
+	if(ringEnter(engine, 0) < 0)
+		return 0;
+	head = __atomic_load_n(engine->sqHead, __ATOMIC_ACQUIRE);
+	return *engine->sqEntries - (engine->localTail - head) >= count;
+}
+
+static struct io_uring_sqe* getSqe(mcp2221_engine_t* engine)
+{
+	unsigned int idx = engine->localTail & *engine->sqMask;
+	struct io_uring_sqe* sqe = &engine->sqes[idx];
+	memset(sqe, 0x00, sizeof(struct io_uring_sqe));
+	engine->sqArray[idx] = idx;
+	engine->localTail++;
+	engine->toSubmit++;
+	return sqe;
+}
+
+// Timeout for the SQE before it
+static void prepTimeout(mcp2221_engine_t* engine, engine_req_t* req, int timeout, uint8_t flags)
+{
+	req->ts.tv_sec = timeout / 1000;
+	req->ts.tv_nsec = (timeout % 1000) * 1000000;
+
+	struct io_uring_sqe* sqe = getSqe(engine);
+	sqe->opcode = IORING_OP_LINK_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uintptr_t)&req->ts;
+	sqe->len = 1;
+	sqe->flags = flags;
+	sqe->user_data = (uintptr_t)req | TAG_TIMEOUT;
+	req->cqes++;
+}
+
+// Queue up a read, linked to a timeout if the device has one
+// The hidraw fd is non-blocking, newer kernels arm a poll for the read but older ones give back EAGAIN instead.
+// After that the read gets a poll in front of it and the timeout goes on the poll.
+static int prepRead(mcp2221_engine_t* engine, engine_req_t* req, int poll)
+{
+	int timeout = mcp2221_getTimeout(req->device);
+
+	if(!reserveSqes(engine, 3))
+		return 0;
+
+	struct io_uring_sqe* sqe;
+	if(poll)
+	{
+		sqe = getSqe(engine);
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = req->fd;
+		sqe->poll_events = POLLIN;
+		sqe->flags = IOSQE_IO_LINK;
+		sqe->user_data = (uintptr_t)req | TAG_POLL;
+		req->cqes++;
+
+		if(timeout >= 0)
+			prepTimeout(engine, req, timeout, IOSQE_IO_LINK);
+	}
+
+	sqe = getSqe(engine);
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = req->fd;
+	sqe->addr = (uintptr_t)req->report->data;
+	sqe->len = REPORT_SIZE;
+	sqe->user_data = (uintptr_t)req | TAG_READ;
+	req->cqes++;
+
+	if(!poll && timeout >= 0)
+	{
+		sqe->flags |= IOSQE_IO_LINK;
+		prepTimeout(engine, req, timeout, 0);
+	}
+
+	return 1;
+}
+
+static int prepRequest(mcp2221_engine_t* engine, engine_req_t* req)
+{
+	req->type = req->report->data[0];
+	req->report->reportId = 0; // hidraw wants the report ID in front, always 0
+
+	if(!reserveSqes(engine, 3))
+		return 0;
+
+	req->start = timeMicros();
+
+	struct io_uring_sqe* sqe = getSqe(engine);
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = req->fd;
+	sqe->addr = (uintptr_t)&req->report->reportId;
+	sqe->len = HID_REPORT_SIZE;
+	sqe->flags = IOSQE_IO_LINK; // Read doesn't start until the write has finished
+	sqe->user_data = (uintptr_t)req | TAG_WRITE;
+	req->cqes++;
+
+	return prepRead(engine, req, 0);
+}
+
+static void handleCqe(mcp2221_engine_t* engine, struct io_uring_cqe* cqe)
+{
+	engine_req_t* req = (engine_req_t*)(uintptr_t)(cqe->user_data & ~(uint64_t)TAG_MASK);
+	int tag = cqe->user_data & TAG_MASK;
+
+	switch(tag)
+	{
+		case TAG_WRITE:
+			req->written = (cqe->res == HID_REPORT_SIZE);
+			if(!req->written)
+				req->result = MCP2221_ERROR_HID;
+			break;
+		case TAG_READ:
+			if(cqe->res == REPORT_SIZE)
+			{
+				if(!isStaleResponse(req->device, req->report->data, req->type))
+				{
+					updateRTT(req->device, timeMicros() - req->start);
+					req->result = checkStatus(req->device, req->report->data);
+					if(req->stale)
+						req->device->priv->stats.resyncs++;
+				}
+				else
+				{
+					// Leftover response from something else, wait for the right one
+					req->stale = 1;
+					req->sameType = (req->report->data[0] == req->type);
+					if(!prepRead(engine, req, 0))
+						req->result = MCP2221_ERROR;
+				}
+			}
+			else if(cqe->res == -EAGAIN)
+			{
+				// Kernel didn't wait for the response, wait with a poll
+				if(!prepRead(engine, req, 1))
+					req->result = MCP2221_ERROR;
+			}
+			else if(cqe->res == -ECANCELED && req->written && req->result == MCP2221_SUCCESS)
+			{
+				req->result = MCP2221_ERROR_TIMEOUT;
+				missedResponse(req->device, req->type, req->sameType);
+				if(req->device->priv->timeout == MCP2221_TIMEOUT_ADAPTIVE)
+					backoffRTT(req->device);
+			}
+			else if(req->result == MCP2221_SUCCESS)
+				req->result = MCP2221_ERROR_HID;
+			break;
+		case TAG_POLL:
+			// Timing out cancels the poll, anything else is the device going away
+			if(cqe->res < 0 && cqe->res != -ECANCELED)
+				req->result = MCP2221_ERROR_HID;
+			break;
+		default: // Timeout, the read has the result
+			break;
+	}
+
+	if(--req->cqes == 0)
+	{
+		responseQueueDrop(&req->device->priv->pending, 1);
+		engine->inFlight--;
+		finishRequest(engine, req);
+	}
+}
+
+static void reap(mcp2221_engine_t* engine)
+{
+	unsigned int head = *engine->cqHead;
+	unsigned int tail = __atomic_load_n(engine->cqTail, __ATOMIC_ACQUIRE);
+	for(;head != tail;head++)
+		handleCqe(engine, &engine->cqes[head & *engine->cqMask]);
+	__atomic_store_n(engine->cqHead, head, __ATOMIC_RELEASE);
+}
+
+#endif
+
+mcp2221_engine_t* LIB_EXPORT mcp2221_engineCreate(int maxRequests)
+{
+	if(maxRequests < 1)
+		return NULL;
+
+	mcp2221_engine_t* engine = calloc(1, sizeof(mcp2221_engine_t));
+	if(!engine)
+		return NULL;
+
+	engine->reqs = calloc(maxRequests, sizeof(engine_req_t));
+	if(!engine->reqs)
+	{
+		free(engine);
+		return NULL;
+	}
+
+	for(int i=0;i<maxRequests;i++)
+	{
+		engine->reqs[i].next = engine->freeList;
+		engine->freeList = &engine->reqs[i];
+	}
+
+#ifdef ENGINE_IO_URING
+	// Write, read and timeout for each request, plus room for some re-reads
+	// io_uring might be disabled (kernel.io_uring_disabled, seccomp etc), everything then uses the blocking fallback
+	engine->ringFd = -1;
+	if(!ringSetup(engine, (maxRequests * 4) + 8))
+		ringFree(engine);
+#endif
+
+	return engine;
+}
+
+void LIB_EXPORT mcp2221_engineDestroy(mcp2221_engine_t* engine)
+{
+	if(!engine)
+		return;
+
+	// Buffers in the requests can't be freed while the kernel might still write to them
+	while(engine->inFlight)
+		mcp2221_engineRun(engine, 1);
+
+#ifdef ENGINE_IO_URING
+	ringFree(engine);
+#endif
+	free(engine->reqs);
+	free(engine);
+}
+
+mcp2221_error LIB_EXPORT mcp2221_engineSubmit(mcp2221_engine_t* engine, mcp2221_t* device, mcp2221_report_t* report, mcp2221_engine_callback_t callback, void* userData)
+{
+	if(!engine || !device || !report)
+		return MCP2221_INVALID_ARG;
+	else if(device->priv->pending.count || !engine->freeList) // Only one request per device at a time
+		return MCP2221_ERROR;
+
+	engine_req_t* req = engine->freeList;
+	engine->freeList = req->next;
+
+	req->next = NULL;
+	req->device = device;
+	req->report = report;
+	req->callback = callback;
+	req->userData = userData;
+	req->result = MCP2221_SUCCESS;
+
+#ifdef ENGINE_IO_URING
+	req->fd = (engine->ringFd >= 0) ? hidraw_getFd(device) : -1;
+	if(req->fd >= 0)
+	{
+		req->cqes = 0;
+		req->written = 0;
+		req->stale = 0;
+		req->sameType = 0;
+		if(!prepRequest(engine, req))
+		{
+			req->next = engine->freeList;
+			engine->freeList = req;
+			return MCP2221_ERROR;
+		}
+		responseQueuePush(&device->priv->pending, req->type);
+		engine->inFlight++;
+		return MCP2221_SUCCESS;
+	}
+#endif
+
+	// Not something we can do asynchronously, just do it now and report the result from mcp2221_engineRun()
+	req->result = mcp2221_rawReportTimeout(device, report, device->priv->timeout);
+	finishRequest(engine, req);
+
+	return MCP2221_SUCCESS;
+}
+
+int LIB_EXPORT mcp2221_engineRun(mcp2221_engine_t* engine, int wait)
+{
+	if(!engine)
+		return MCP2221_INVALID_ARG;
+
+#ifdef ENGINE_IO_URING
+	if(engine->ringFd >= 0 && (engine->toSubmit || engine->inFlight))
+	{
+		unsigned int minComplete = (wait && engine->inFlight && !engine->doneHead) ? 1 : 0;
+		if(ringEnter(engine, minComplete) < 0)
+			return MCP2221_ERROR;
+		reap(engine);
+	}
+#else
+	UNUSED(wait);
+#endif
+
+	// Callbacks might submit new requests, so take the list first
+	engine_req_t* req = engine->doneHead;
+	engine->doneHead = engine->doneTail = NULL;
+
+	int count = 0;
+	while(req)
+	{
+		engine_req_t* next = req->next;
+
+		mcp2221_t* device = req->device;
+		mcp2221_report_t* report = req->report;
+		mcp2221_engine_callback_t callback = req->callback;
+		void* userData = req->userData;
+		mcp2221_error result = req->result;
+
+		req->next = engine->freeList;
+		engine->freeList = req;
+
+		if(callback)
+			callback(device, result, report, userData);
+
+		count++;
+		req = next;
+	}
+
+	return count;
+}
@@ -0,0 +1,264 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Linux hidraw backend, talks to /dev/hidrawN directly instead of going through HIDAPI
+
+#ifdef __linux__
+
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include "libmcp2221.h"
+#include "internal.h"
+
+#define SYSFS_HIDRAW	"/sys/class/hidraw"
+
+typedef struct{
+	int fd;
+}hidraw_t;
+
+static mcp2221_error hidrawSend(void* handle, uint8_t* report)
+{
+	hidraw_t* dev = handle;
+
+	// The byte before the report is reserved for the report ID (see mcp2221_report_t)
+	uint8_t* reportData = report - 1;
+	reportData[0] = 0; // Report ID, always 0
+
+	ssize_t res;
+	while((res = write(dev->fd, reportData, HID_REPORT_SIZE)) < 0 && errno == EINTR);
+
+	if(res != HID_REPORT_SIZE)
+	{
+		debug_printf("ERR (send): %s\n", res < 0 ? strerror(errno) : "Short write");
+		return MCP2221_ERROR_HID;
+	}
+
+	return MCP2221_SUCCESS;
+}
+
+static mcp2221_error hidrawReceive(void* handle, uint8_t* report, int timeout)
+{
+	hidraw_t* dev = handle;
+
+	struct pollfd pfd = {
+		.fd = dev->fd,
+		.events = POLLIN
+	};
+
+	// Keep track of the deadline in case poll() gets interrupted
+	uint64_t deadline = timeMicros() + ((uint64_t)timeout * 1000);
+	ssize_t len;
+	do
+	{
+		int res;
+		while((res = poll(&pfd, 1, timeout)) < 0 && errno == EINTR)
+		{
+			if(timeout > 0)
+			{
+				uint64_t now = timeMicros();
+				timeout = (now < deadline) ? (deadline - now) / 1000 : 0;
+			}
+		}
+
+		if(res == 0)
+		{
+			debug_puts("ERR (get): Timeout");
+			return MCP2221_ERROR_TIMEOUT;
+		}
+		else if(res < 0 || (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)))
+		{
+			debug_puts("ERR (get): Device gone");
+			return MCP2221_ERROR_HID;
+		}
+
+		// MCP2221 doesn't use numbered reports so the kernel gives us the report without an ID byte
+		while((len = read(dev->fd, report, REPORT_SIZE)) < 0 && errno == EINTR);
+
+		// The fd is non-blocking, go back to waiting if the report has already gone
+		if(len < 0 && errno == EAGAIN && timeout > 0)
+		{
+			uint64_t now = timeMicros();
+			timeout = (now < deadline) ? (deadline - now) / 1000 : 0;
+		}
+	}
+	while(len < 0 && errno == EAGAIN);
+
+	if(len != REPORT_SIZE)
+	{
+		debug_printf("ERR (get): %s\n", len < 0 ? strerror(errno) : "Short read");
+		return MCP2221_ERROR_HID;
+	}
+
+	return MCP2221_SUCCESS;
+}
+
+static void hidrawClose(void* handle)
+{
+	hidraw_t* dev = handle;
+	close(dev->fd);
+	free(dev);
+}
+
+static int hidrawPollFd(void* handle)
+{
+	hidraw_t* dev = handle;
+	return dev->fd;
+}
+
+static const mcp2221_transport_t hidrawTransport = {
+	.send = hidrawSend,
+	.receive = hidrawReceive,
+	.close = hidrawClose,
+	.pollFd = hidrawPollFd
+};
+
+mcp2221_t* hidraw_open(mcp2221_ctx_t* ctx, const char* path, mcp2221_error* error)
+{
+	// Non-blocking so io_uring reads in the engine wait with a poll instead of tying up a kernel worker thread each
+	int fd = open(path, O_RDWR | O_CLOEXEC | O_NONBLOCK);
+	if(fd < 0)
+	{
+		*error = MCP2221_ERROR_HID;
+		return NULL;
+	}
+
+	hidraw_t* dev = malloc(sizeof(hidraw_t));
+	if(!dev)
+	{
+		close(fd);
+		*error = MCP2221_ERROR;
+		return NULL;
+	}
+	dev->fd = fd;
+
+	return openTransport(ctx, &hidrawTransport, dev, path, error);
+}
+
+// File descriptor of a device opened by hidraw_open(), -1 for devices using some other backend
+int hidraw_getFd(mcp2221_t* device)
+{
+	if(device->priv->transport != &hidrawTransport)
+		return -1;
+	return ((hidraw_t*)device->handle)->fd;
+}
+
+// Read a single line sysfs attribute into a wide string
+// The strings are widened byte by byte, USB descriptors are pretty much always ASCII
+static int readAttribute(const char* name, const char* attr, wchar_t* dest)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), SYSFS_HIDRAW "/%s/device/../../%s", name, attr);
+
+	FILE* f = fopen(path, "r");
+	if(!f)
+		return 0;
+
+	char buff[MCP2221_STR_LEN * 4];
+	int ok = fgets(buff, sizeof(buff), f) != NULL;
+	fclose(f);
+	if(!ok)
+		return 0;
+
+	int len = 0;
+	for(;buff[len] && buff[len] != '\n' && len < MCP2221_STR_LEN - 1;len++)
+		dest[len] = (unsigned char)buff[len];
+	dest[len] = L'\0';
+
+	return 1;
+}
+
+// Get VID and PID from the HID_ID line of the uevent file, returns 0 if this isn't a USB device
+static int readIDs(const char* name, int* vid, int* pid)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), SYSFS_HIDRAW "/%s/device/uevent", name);
+
+	FILE* f = fopen(path, "r");
+	if(!f)
+		return 0;
+
+	int found = 0;
+	char line[256];
+	while(fgets(line, sizeof(line), f))
+	{
+		unsigned int bus, v, p;
+		if(sscanf(line, "HID_ID=%x:%x:%x", &bus, &v, &p) == 3)
+		{
+			found = (bus == 0x03); // BUS_USB
+			*vid = v;
+			*pid = p;
+			break;
+		}
+	}
+	fclose(f);
+
+	return found;
+}
+
+// Check a single hidraw device (e.g. "hidraw3"), calls the callback and returns 1 if it matches the VID and PID
+int hidraw_probe(const char* name, int vid, int pid, hidraw_enum_t callback, void* userData)
+{
+	int devVid, devPid;
+	if(!readIDs(name, &devVid, &devPid))
+		return 0;
+	if((vid && vid != devVid) || (pid && pid != devPid))
+		return 0;
+
+	char devPath[PATH_MAX];
+	snprintf(devPath, sizeof(devPath), "/dev/%s", name);
+
+	wchar_t manufacturer[MCP2221_STR_LEN];
+	wchar_t product[MCP2221_STR_LEN];
+	wchar_t serial[MCP2221_STR_LEN];
+	int hasManufacturer = readAttribute(name, "manufacturer", manufacturer);
+	int hasProduct = readAttribute(name, "product", product);
+	int hasSerial = readAttribute(name, "serial", serial);
+
+	debug_printf("Device Found\n  type: %04x %04x\n  path: %s\n", devVid, devPid, devPath);
+
+	callback(
+		userData,
+		devPath,
+		hasManufacturer ? manufacturer : NULL,
+		hasProduct ? product : NULL,
+		hasSerial ? serial : NULL
+	);
+
+	return 1;
+}
+
+int hidraw_enumerate(int vid, int pid, hidraw_enum_t callback, void* userData)
+{
+	DIR* dir = opendir(SYSFS_HIDRAW);
+	if(!dir)
+		return 0;
+
+	int count = 0;
+	struct dirent* ent;
+	while((ent = readdir(dir)))
+	{
+		if(strncmp(ent->d_name, "hidraw", 6) != 0)
+			continue;
+		count += hidraw_probe(ent->d_name, vid, pid, callback, userData);
+	}
+
+	closedir(dir);
+
+	return count;
+}
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+#ifndef INTERNAL_H_
+#define INTERNAL_H_
+
+// Stuff shared between the library source files, not part of the public API
+
+#include <stdint.h>
+#include "libmcp2221.h"
+
+#define UNUSED(var) ((void)(var))
+
+#define DEBUG_INFO_HID	0
+#define REPORT_SIZE		MCP2221_REPORT_SIZE
+#define HID_REPORT_SIZE	REPORT_SIZE + 1 // + 1 for report ID, which is always 0 for MCP2221
+
+#ifdef _WIN32
+	#define LIB_EXPORT __declspec(dllexport)
+#else
+	#define LIB_EXPORT
+#endif
+
+// Reports live in a mcp2221_report_t so the transport can put the report ID in front without copying
+#define NEW_REPORT(report) mcp2221_report_t report##Buff; uint8_t* report = report##Buff.data;
+
+#if !DEBUG_INFO_HID
+#define debug_printf(fmt, ...)	((void)(0))
+#define debug_puts(str)			((void)(0))
+#else
+#define debug_printf(fmt, ...)	(printf(fmt, ## __VA_ARGS__))
+#define debug_puts(str)			(puts(str))
+#endif
+
+typedef enum
+{
+	USB_CMD_STATUSSET	= 0x10,
+	USB_CMD_READFLASH	= 0xB0,
+	USB_CMD_WRITEFLASH	= 0xB1,
+	USB_CMD_FLASHPASS	= 0xB2,
+	USB_CMD_I2CWRITE	= 0x90,
+	USB_CMD_I2CWRITE_REPEATSTART	= 0x92,
+	USB_CMD_I2CWRITE_NOSTOP			= 0x94,
+	USB_CMD_I2CREAD		= 0x91,
+	USB_CMD_I2CREAD_REPEATSTART		= 0x93,
+	USB_CMD_I2CREAD_GET	= 0x40,
+	USB_CMD_SETGPIO		= 0x50,
+	USB_CMD_GETGPIO		= 0x51,
+	USB_CMD_SETSRAM		= 0x60,
+	USB_CMD_GETSRAM		= 0x61,
+	USB_CMD_RESET		= 0x70
+}usb_cmd_t;
+
+typedef enum
+{
+	FLASH_SECTION_CHIPSETTINGS		= 0x00,
+	FLASH_SECTION_GPIOSETTINGS		= 0x01,
+	FLASH_SECTION_USBMANUFACTURER	= 0x02,
+	FLASH_SECTION_USBPRODUCT		= 0x03,
+	FLASH_SECTION_USBSERIAL			= 0x04,
+	FLASH_SECTION_FACTORYSERIAL		= 0x05,
+}flash_section_t;
+
+#define FLASH_SECTION_COUNT	6
+
+#define RESPONSE_QUEUE_SIZE	32
+
+// Command types of responses that are still to come, oldest first
+typedef struct{
+	uint8_t types[RESPONSE_QUEUE_SIZE];
+	int count;
+}response_queue_t;
+
+// Monotonic time in microseconds
+uint64_t timeMicros(void);
+// Feed a round trip time in microseconds into the adaptive timeout
+void updateRTT(mcp2221_t* device, uint32_t rtt);
+// A request using the adaptive timeout timed out, back off
+void backoffRTT(mcp2221_t* device);
+void responseQueuePush(response_queue_t* queue, uint8_t type);
+void responseQueueDrop(response_queue_t* queue, int count);
+mcp2221_error checkStatus(mcp2221_t* device, const uint8_t* report);
+int isStaleResponse(mcp2221_t* device, const uint8_t* report, uint8_t type);
+// The response to a request of the given type didn't turn up in time, nonzero maybeGotIt clears owed instead of expecting the response later
+void missedResponse(mcp2221_t* device, uint8_t type, int maybeGotIt);
+
+// registry.c
+typedef struct registry_t registry_t;
+registry_t* registryCreate(void);
+void registryDestroy(registry_t* registry);
+void registryClear(registry_t* registry);
+int registryAdd(registry_t* registry, const char* path, const wchar_t* serial);
+int registryRemove(registry_t* registry, const char* path);
+int registryFindPath(registry_t* registry, const char* path);
+int registryCount(registry_t* registry);
+char* registryPath(registry_t* registry, int idx);
+char* registryFindSerial(registry_t* registry, const wchar_t* serial);
+char* registryFindFactorySerial(registry_t* registry, const char* factorySerial);
+void registrySetFactorySerial(registry_t* registry, const char* path, const char* factorySerial);
+
+// Enumeration state, see mcp2221_ctxCreate()
+struct mcp2221_ctx_t{
+	registry_t* registry;	// Devices found by mcp2221_ctxFind()
+	int lazyOpen;			// Only read the SRAM settings when opening, see mcp2221_ctxSetLazyOpen()
+};
+
+// Device state that isn't part of the public API, see mcp2221_t.priv
+struct mcp2221_private_t{
+	const mcp2221_transport_t* transport;	// Transport backend used by this device
+	int timeout;			// Response timeout in milliseconds, MCP2221_TIMEOUT_ADAPTIVE or MCP2221_TIMEOUT_INFINITE
+	uint32_t srtt;			// Smoothed round trip time in microseconds, used for the adaptive timeout
+	uint32_t rttvar;		// Round trip time variation in microseconds
+	void* async;			// I/O thread state, see mcp2221_asyncStart()
+	response_queue_t pending;	// Reports sent with mcp2221_submitReport() or an engine that haven't been completed yet
+	response_queue_t owed;	// Responses to timed out requests that may still turn up
+	int retries;			// Extra attempts for requests that are safe to repeat
+	int retryBackoff;		// Milliseconds to wait before the first retry
+	mcp2221_stats_t stats;	// Transport statistics
+	uint8_t sram[REPORT_SIZE];	// Copy of the SRAM settings in GETSRAM response format, see mcp2221_setSRAMCache()
+	int sramValid;			// sram[] matches the device
+	int sramCache;			// Getters use sram[] instead of asking the device
+	int suppressWrites;		// Don't send SRAM and GPIO writes that match sram[]
+	uint32_t sramGeneration;	// Incremented whenever sram[] changes
+	void* flash;			// Copy of the flash sections, see mcp2221_setFlashCache() and mcp2221_flashBegin()
+	int flashCache;			// load* functions use the flash copy instead of asking the device
+	uint8_t flashPassword[MCP2221_PASSWORD_LEN];	// Flash password, put into chip settings writes while password protection is on
+	int flashUnlocked;		// flashPassword has been accepted by the device since it was opened or reset
+	int flashPasswordSet;	// flashPassword came from mcp2221_unlockFlash() or mcp2221_savePassword(), otherwise it's all zeros
+	int usbInfoLoaded;		// All of usbInfo has been filled in
+};
+
+// libmcp2221.c
+mcp2221_ctx_t* getDefaultCtx(void);	// NULL until mcp2221_init() has been called
+mcp2221_t* openTransport(mcp2221_ctx_t* ctx, const mcp2221_transport_t* transport, void* handle, const char* path, mcp2221_error* error);
+mcp2221_t* openIndex(mcp2221_ctx_t* ctx, int idx, mcp2221_error* error);
+uint8_t gpioConfValue(const mcp2221_gpioconf_t* conf);
+
+// async.c
+// Returns 1 if called from the I/O thread of the device, the thread closes the device once it has stopped
+int asyncDeferClose(mcp2221_t* device);
+
+#ifdef __linux__
+// hidraw.c
+typedef void (*hidraw_enum_t)(void* userData, const char* path, const wchar_t* manufacturer, const wchar_t* product, const wchar_t* serial);
+int hidraw_enumerate(int vid, int pid, hidraw_enum_t callback, void* userData);
+int hidraw_probe(const char* name, int vid, int pid, hidraw_enum_t callback, void* userData);
+mcp2221_t* hidraw_open(mcp2221_ctx_t* ctx, const char* path, mcp2221_error* error);
+int hidraw_getFd(mcp2221_t* device);
+#endif
+
+#endif /* INTERNAL_H_ */
@@ -6,153 +6,68 @@
  * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
  */
 
+#ifndef _WIN32
+	#define _POSIX_C_SOURCE 200809L
+	#include <time.h>
+#else
+	#include "win/win.h"
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
-#include "hidapi.h"
 #include "libmcp2221.h"
+#include "internal.h"
 
-#define UNUSED(var) ((void)(var))
-
-#define DEBUG_INFO_HID	0
-#define REPORT_SIZE		MCP2221_REPORT_SIZE
-#define HID_REPORT_SIZE	REPORT_SIZE + 1 // + 1 for report ID, which is always 0 for MCP2221
-
-#ifdef _WIN32
-	#define LIB_EXPORT __declspec(dllexport)
-#else
-	#define LIB_EXPORT
+// Build with MCP2221_HIDRAW defined to use the Linux hidraw backend instead of HIDAPI
+#if defined(MCP2221_HIDRAW) && !defined(__linux__)
+	#error "The hidraw backend is only available on Linux"
 #endif
 
-#define NEW_REPORT(report) uint8_t report[REPORT_SIZE];
-
-#if !DEBUG_INFO_HID
-#define debug_printf(fmt, ...)	((void)(0))
-#define debug_puts(str)			((void)(0))
-#else
-#define debug_printf(fmt, ...)	(printf(fmt, ## __VA_ARGS__))
-#define debug_puts(str)			(puts(str))
+#ifndef MCP2221_HIDRAW
+	#include "hidapi.h"
 #endif
 
-typedef enum
-{
-	USB_CMD_STATUSSET	= 0x10,
-	USB_CMD_READFLASH	= 0xB0,
-	USB_CMD_WRITEFLASH	= 0xB1,
-	USB_CMD_FLASHPASS	= 0xB2,
-	USB_CMD_I2CWRITE	= 0x90,
-	USB_CMD_I2CWRITE_REPEATSTART	= 0x92,
-	USB_CMD_I2CWRITE_NOSTOP			= 0x94,
-	USB_CMD_I2CREAD		= 0x91,
-	USB_CMD_I2CREAD_REPEATSTART		= 0x93,
-	USB_CMD_I2CREAD_GET	= 0x40,
-	USB_CMD_SETGPIO		= 0x50,
-	USB_CMD_GETGPIO		= 0x51,
-	USB_CMD_SETSRAM		= 0x60,
-	USB_CMD_GETSRAM		= 0x61,
-	USB_CMD_RESET		= 0x70
-}usb_cmd_t;
-
-typedef enum
-{
-	FLASH_SECTION_CHIPSETTINGS		= 0x00,
-	FLASH_SECTION_GPIOSETTINGS		= 0x01,
-	FLASH_SECTION_USBMANUFACTURER	= 0x02,
-	FLASH_SECTION_USBPRODUCT		= 0x03,
-	FLASH_SECTION_USBSERIAL			= 0x04,
-	FLASH_SECTION_FACTORYSERIAL		= 0x05,
-}flash_section_t;
-
-typedef struct device_list_t device_list_t;
-struct device_list_t{
-	device_list_t* next;	// Next device in list
-	char* devPath;			// Device path (this is unique to each physical device)
-	wchar_t* serial;		// Serial number
-	int id;					// ID
-};
+#define TIMEOUT_INITIAL	1000	// Timeout used until some round trip times have been measured (ms)
+#define TIMEOUT_MIN		50		// Flash writes can take a while, don't go below this (ms)
+#define TIMEOUT_MAX		5000
+#define PIPELINE_DEPTH	8		// Maximum reports in flight, HIDAPI's libusb backend only buffers 30 input reports
+#define RETRY_DEFAULT	2		// Extra attempts for requests that are safe to repeat
+#define RETRY_BACKOFF	5		// Delay before the first retry (ms), doubles for each retry after that
+#define RETRY_BACKOFF_MAX	200
+#define RETRY_PREFIX	5		// Idempotent commands only use this many bytes of the request
 
-// Linked list of devices
-static device_list_t* devList;
+// Context used by the functions that don't take one (mcp2221_find(), mcp2221_open() etc)
+// Only created and destroyed by mcp2221_init() and mcp2221_exit(), so using it from other threads doesn't race to create it
+static mcp2221_ctx_t defaultCtx;
 
-// Clear linked list of all devices
-static void clearUsbDevList(void)
+mcp2221_ctx_t* getDefaultCtx(void)
 {
-	device_list_t* dev = devList;
-	while(dev)
-	{
-		free(dev->devPath);
-		free(dev->serial);
-
-		device_list_t* temp = dev;
-		dev = dev->next;
-		free(temp);
-	}
-	devList = NULL;
+	return defaultCtx.registry ? &defaultCtx : NULL;
 }
 
-// Add a device to linked list
-static void addUsbDevList(int id, struct hid_device_info* dev2)
-{
-	device_list_t* dev = devList;
-	if(dev != NULL) // Root is defined
-	{
-		// Find last item
-		for(;dev->next;dev = dev->next);
-
-		// Make next item
-		dev->next = malloc(sizeof(device_list_t));
-		dev = dev->next;
-	}
-	else // No root, need to make it
-	{
-		// Make root item
-		devList = malloc(sizeof(device_list_t));
-		dev = devList;
-	}
-
-	// Assign data
-	dev->next = NULL;
-
-	// TODO use wcsdup and stuff here instead of malloc?
-
-	// Path
-	dev->devPath = malloc(strlen(dev2->path) + 1);
-	strcpy(dev->devPath, dev2->path);
-
-	// Serial
-	if(!dev2->serial_number)
-		dev->serial = NULL;
-	else
-	{
-		int len = wcslen(dev2->serial_number);
-		dev->serial = malloc((len * sizeof(wchar_t)) + sizeof(wchar_t));
-		wcsncpy(dev->serial, dev2->serial_number, len);
-		dev->serial[len] = L'\0';
-	}
-
-	dev->id = id;
-}
+#ifndef MCP2221_HIDRAW
 
-static mcp2221_error doUSBget(hid_device* handle, void* data)
+static mcp2221_error doUSBget(void* handle, uint8_t* data, int timeout)
 {
 	if(!handle || !data)
 		return MCP2221_INVALID_ARG;
 
-	uint8_t reportData[HID_REPORT_SIZE];
-	memset(reportData, 0x00, HID_REPORT_SIZE);
+	// Get the report, HIDAPI strips the report ID so it can go straight into the caller's buffer
+	int res = hid_read_timeout(handle, data, REPORT_SIZE, timeout);
 
-	// TODO
-	// use hid_read_timeout or maybe use some non-blocking stuff?
-	
-	// Get the report
-	int res = hid_read(handle, reportData, HID_REPORT_SIZE);
+	if(res == 0)
+	{
+		debug_puts("ERR (get): Timeout");
+		return MCP2221_ERROR_TIMEOUT;
+	}
 
 	debug_printf("---- Get Feature Report ----\n");
 	debug_printf("  Len: %d\n", res);
 	debug_printf("  ");
 	for (int i = 0; i < res; i++)
-		debug_printf("%02hhx ", reportData[i]);
+		debug_printf("%02hhx ", data[i]);
 	debug_puts("");
 
 	if(res != REPORT_SIZE)
@@ -160,22 +75,20 @@ static mcp2221_error doUSBget(hid_device* handle, void* data)
 		if(res < 0)
 			debug_printf("ERR (get): %ls\n", hid_error(handle));
 		else
-			debug_printf("ERR (get): Data error, returned report length (%d) does not match requested length (%u)\n", res, HID_REPORT_SIZE);
+			debug_printf("ERR (get): Data error, returned report length (%d) does not match requested length (%u)\n", res, REPORT_SIZE);
 		return MCP2221_ERROR_HID;
 	}
 
-	memcpy(data, reportData, res);
-
 	return MCP2221_SUCCESS;
 }
 
-static mcp2221_error doUSBsend(hid_device* handle, void* data)
+static mcp2221_error doUSBsend(void* handle, uint8_t* data)
 {
 	if(!handle || !data)
 		return MCP2221_INVALID_ARG;
 
-	uint8_t reportData[HID_REPORT_SIZE];
-	memcpy(reportData + 1, data, REPORT_SIZE);
+	// The byte before the report is reserved for the report ID (see mcp2221_report_t)
+	uint8_t* reportData = data - 1;
 	reportData[0] = 0; // Set the report ID, always 0
 
 	// Send the report
@@ -197,18 +110,33 @@ static mcp2221_error doUSBsend(hid_device* handle, void* data)
 	return MCP2221_SUCCESS;
 }
 
-static mcp2221_error USBget(mcp2221_t* device, void* data)
+static void doUSBclose(void* handle)
+{
+	hid_close(handle);
+}
+
+// HIDAPI transport, used for devices opened through mcp2221_find()
+static const mcp2221_transport_t hidTransport = {
+	.send = doUSBsend,
+	.receive = doUSBget,
+	.close = doUSBclose,
+	.pollFd = NULL // HIDAPI doesn't give us access to its file descriptors
+};
+
+#endif
+
+static mcp2221_error USBget(mcp2221_t* device, uint8_t* data, int timeout)
 {
 	if(!device)
 		return MCP2221_INVALID_ARG;
-	return doUSBget(device->handle, data);
+	return device->priv->transport->receive(device->handle, data, timeout);
 }
 
-static mcp2221_error USBsend(mcp2221_t* device, void* data)
+static mcp2221_error USBsend(mcp2221_t* device, uint8_t* data)
 {
 	if(!device)
 		return MCP2221_INVALID_ARG;
-	return doUSBsend(device->handle, data);
+	return device->priv->transport->send(device->handle, data);
 }
 
 static void clearReport(void* report)
@@ -216,6 +144,14 @@ static void clearReport(void* report)
 	memset(report, 0x00, REPORT_SIZE);
 }
 
+// Clear out something secret, volatile so the compiler can't skip it just because the memory is about to be freed
+static void wipe(void* data, size_t len)
+{
+	volatile uint8_t* bytes = data;
+	while(len--)
+		*bytes++ = 0x00;
+}
+
 static mcp2221_error setReport(mcp2221_t* device, uint8_t* report, uint8_t type)
 {
 	if(!device)
@@ -225,338 +161,1076 @@ static mcp2221_error setReport(mcp2221_t* device, uint8_t* report, uint8_t type)
 	return MCP2221_SUCCESS;
 }
 
-static mcp2221_error getResponse(mcp2221_t* device, uint8_t* report, uint8_t type)
+uint64_t timeMicros()
 {
-	clearReport(report);
-	report[0] = type;
-	mcp2221_error res = USBget(device, report);
-	return res;
+#ifdef _WIN32
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (now.QuadPart / freq.QuadPart * 1000000) + ((now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+#endif
 }
 
-static mcp2221_error doTransaction(mcp2221_t* device, uint8_t* report)
+// Timeout is a few times the smoothed round trip time, same idea as TCP retransmit timeouts (RFC 6298)
+static int adaptiveTimeout(mcp2221_t* device)
 {
-	uint8_t type = report[0];
-	mcp2221_error res;
-	if((res = USBsend(device, report)) == MCP2221_SUCCESS)
-		res = getResponse(device, report, type);
-	return res;
+	if(!device->priv->srtt)
+		return TIMEOUT_INITIAL;
+
+	uint32_t timeout = (device->priv->srtt + (4 * device->priv->rttvar) + 999) / 1000;
+	if(timeout < TIMEOUT_MIN)
+		timeout = TIMEOUT_MIN;
+	else if(timeout > TIMEOUT_MAX)
+		timeout = TIMEOUT_MAX;
+	return timeout;
 }
 
-// Reads FLASH data for updating
-static int saveReport(mcp2221_t* device, uint8_t* report)
+void updateRTT(mcp2221_t* device, uint32_t rtt)
 {
-	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_READFLASH)) != MCP2221_SUCCESS)
-		return res;
-	report[1] = FLASH_SECTION_CHIPSETTINGS;
-	res = doTransaction(device, report);
-	return res;
+	if(!device->priv->srtt)
+	{
+		device->priv->srtt = rtt ? rtt : 1;
+		device->priv->rttvar = rtt / 2;
+	}
+	else
+	{
+		uint32_t delta = (rtt > device->priv->srtt) ? rtt - device->priv->srtt : device->priv->srtt - rtt;
+		device->priv->rttvar = ((3 * device->priv->rttvar) + delta) / 4;
+		device->priv->srtt = ((7 * device->priv->srtt) + rtt) / 8;
+		if(!device->priv->srtt)
+			device->priv->srtt = 1;
+	}
 }
 
-static void saveReportUpdate(uint8_t* report, uint8_t* reportUpdate)
+void backoffRTT(mcp2221_t* device)
 {
-	clearReport(reportUpdate);
-	memcpy(reportUpdate, &report[2], REPORT_SIZE - 2);
-	reportUpdate[0] = USB_CMD_WRITEFLASH;
-	reportUpdate[1] = FLASH_SECTION_CHIPSETTINGS;
+	if(device->priv->srtt)
+		device->priv->srtt = (device->priv->srtt < (TIMEOUT_MAX * 1000) / 2) ? device->priv->srtt * 2 : TIMEOUT_MAX * 1000;
 }
 
-static mcp2221_error getDescriptor(mcp2221_t* device, uint8_t* report, wchar_t* dest, flash_section_t descriptor)
+void responseQueuePush(response_queue_t* queue, uint8_t type)
 {
-	report[1] = descriptor;
-
-	mcp2221_error res;
-	if((res = doTransaction(device, report)) != MCP2221_SUCCESS)
-		return res;
-
-	// USB descriptors are 16-bit unicode characters and do not contain a null terminator
-	// report[2] is the number of bytes + 2, which is double the number of characters + 1 extra
-	int len = (report[2] / 2) - 1;
-
-	if(len > MCP2221_STR_LEN - 1)
-		len = MCP2221_STR_LEN - 1;
-	else if(len < 1) // Empty string
-		len = 0;
-
-	wcsncpy(dest, (wchar_t*)&report[4], len);
-	dest[len] = L'\0'; // Make sure string is null terminated
-
-	return res;
+	// Full, the oldest one has almost certainly been lost by now
+	if(queue->count >= RESPONSE_QUEUE_SIZE)
+		responseQueueDrop(queue, 1);
+	queue->types[queue->count++] = type;
 }
 
-static mcp2221_error setDescriptor(mcp2221_t* device, wchar_t* buffer, flash_section_t section)
+void responseQueueDrop(response_queue_t* queue, int count)
 {
-	if(!buffer)
-		return MCP2221_INVALID_ARG;
-
-	NEW_REPORT(report);
-	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_WRITEFLASH)) != MCP2221_SUCCESS)
-		return res;
-
-	int len = wcslen(buffer);
+	if(count >= queue->count)
+		queue->count = 0;
+	else if(count > 0)
+	{
+		queue->count -= count;
+		memmove(queue->types, &queue->types[count], queue->count);
+	}
+}
 
-	if(len > MCP2221_STR_LEN - 1)
-		len = MCP2221_STR_LEN - 1;
+// Check whether a response belongs to the request we're waiting for, responses for requests that timed out earlier
+// come back first since the MCP2221 handles everything in order
+// A response matching one we're owed means any owed before it were lost, anything else that isn't ours is junk
+int isStaleResponse(mcp2221_t* device, const uint8_t* report, uint8_t type)
+{
+	response_queue_t* owed = &device->priv->owed;
+	int i;
+	for(i=0;i<owed->count;i++)
+	{
+		if(owed->types[i] == report[0])
+			break;
+	}
 
-	report[1] = section;
-	report[2] = (len * 2) + 2;
-	report[3] = 0x03;
-	memcpy(&report[4], buffer, len * 2); // TODO change to wide char copy? we don't want to copy the null term
+	if(i < owed->count)
+		responseQueueDrop(owed, i + 1);
+	else if(report[0] == type)
+	{
+		// Ours, so anything still owed was sent before it and isn't coming
+		owed->count = 0;
+		return 0;
+	}
 
-	res = doTransaction(device, report);
-	return res;
+	debug_printf("Stale response %02hhx, waiting for %02hhx\n", report[0], type);
+	device->priv->stats.staleResponses++;
+	return 1;
 }
 
-// Similar to getDescriptor but a new report is created instead of using an existing one
-static mcp2221_error getDescriptor2(mcp2221_t* device, wchar_t* buffer, flash_section_t section)
+// The response to a request didn't arrive in time, it might still turn up later
+// The device went quiet, so anything older that we were still owed has been lost. If a response of the same type was thrown
+// away as stale then it might have been ours after all, so don't expect anything else otherwise we'd never get back in step.
+void missedResponse(mcp2221_t* device, uint8_t type, int maybeGotIt)
 {
-	NEW_REPORT(report);
-	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_READFLASH)) != MCP2221_SUCCESS)
-		return res;
-	report[1] = section;
-	res = doTransaction(device, report);
-	if(res != MCP2221_SUCCESS)
-		return res;
-
-	int len = (report[2] / 2) - 1;
+	device->priv->stats.timeouts++;
+	device->priv->owed.count = 0;
+	if(!maybeGotIt)
+		responseQueuePush(&device->priv->owed, type);
+}
 
-	if(len > MCP2221_STR_LEN - 1)
-		len = MCP2221_STR_LEN - 1;
+// Status byte, 0 means the command worked
+// Only the flash commands are checked, the rest either always give 0 or (I2C busy etc) have always been left to the caller to look at
+mcp2221_error checkStatus(mcp2221_t* device, const uint8_t* report)
+{
+	switch(report[0])
+	{
+		case USB_CMD_READFLASH:
+		case USB_CMD_WRITEFLASH:
+		case USB_CMD_FLASHPASS:
+			break;
+		default:
+			return MCP2221_SUCCESS;
+	}
 
-	wcsncpy(buffer, (wchar_t*)&report[4], len);
-	buffer[len] = L'\0'; // Make sure string is null terminated
+	if(report[1] == 0x00)
+		return MCP2221_SUCCESS;
 
-	return res;
+	debug_printf("Command %02hhx failed with status %02hhx\n", report[0], report[1]);
+	device->priv->stats.statusErrors++;
+	return MCP2221_ERROR_STATUS;
 }
 
-static mcp2221_error updateGPIOCache(mcp2221_t* device)
+// Wait for the response to a request of the given type, throwing away anything left over from earlier requests
+// The response overwrites the whole report, no need to clear it first
+static mcp2221_error getResponse(mcp2221_t* device, uint8_t* report, uint8_t type, int timeout)
 {
-	NEW_REPORT(report);
+	uint64_t deadline = timeMicros() + ((uint64_t)timeout * 1000);
+	int stale = 0;
+	int sameType = 0;
 	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_GETSRAM)) != MCP2221_SUCCESS)
-		return res;
-	res = doTransaction(device, report);
+	while((res = USBget(device, report, timeout)) == MCP2221_SUCCESS && isStaleResponse(device, report, type))
+	{
+		stale = 1;
+		sameType = (report[0] == type);
+		if(timeout > 0)
+		{
+			uint64_t now = timeMicros();
+			timeout = (now < deadline) ? (deadline - now) / 1000 : 0;
+		}
+	}
+
 	if(res == MCP2221_SUCCESS)
 	{
-		for(int i=0;i<MCP2221_GPIO_COUNT;i++)
-			device->gpioCache[i] = report[22 + i];
+		if(stale)
+			device->priv->stats.resyncs++;
 	}
+	else if(res == MCP2221_ERROR_TIMEOUT)
+		missedResponse(device, type, sameType);
+
 	return res;
 }
 
-static mcp2221_error getUSBInfo(mcp2221_t* device)
+// Blocking requests have to wait behind reports sent with mcp2221_submitReport(), those responses are now owed and get thrown away
+static void abandonPending(mcp2221_t* device)
 {
-	NEW_REPORT(report);
-	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_READFLASH)) != MCP2221_SUCCESS)
-		return res;
-	else if((res = getDescriptor(device, report, device->usbInfo.manufacturer,	FLASH_SECTION_USBMANUFACTURER))	!= MCP2221_SUCCESS)
-		return res;
-	else if((res = getDescriptor(device, report, device->usbInfo.product,		FLASH_SECTION_USBPRODUCT))		!= MCP2221_SUCCESS)
-		return res;
-	else if((res = getDescriptor(device, report, device->usbInfo.serial,		FLASH_SECTION_USBSERIAL))		!= MCP2221_SUCCESS)
-		return res;
-
-	// Factory serial
-	report[1] = FLASH_SECTION_FACTORYSERIAL;
-	if((res = doTransaction(device, report)) != MCP2221_SUCCESS)
-		return res;
-	device->usbInfo.factorySerialLen = report[2];
-	if(device->usbInfo.factorySerialLen > 60)
-		device->usbInfo.factorySerialLen = 60;
-	memcpy(device->usbInfo.factorySerial, &report[4], report[2]);
-	device->usbInfo.factorySerial[device->usbInfo.factorySerialLen] = 0x00; // Make sure we're null terminated
-
-	// Firmware and hardware version
-	setReport(device, report, USB_CMD_STATUSSET);
-	if((res = doTransaction(device, report)) != MCP2221_SUCCESS)
-		return res;
-	device->usbInfo.hardware[0] = report[46];
-	device->usbInfo.hardware[1] = report[47];
-	device->usbInfo.firmware[0] = report[48];
-	device->usbInfo.firmware[1] = report[49];
-
-	// VID & PID
-	setReport(device, report, USB_CMD_GETSRAM);
-//	setReport(device, report, USB_CMD_READFLASH);
-//	report[1] = FLASH_SECTION_CHIPSETTINGS;
-	if((res = doTransaction(device, report)) != MCP2221_SUCCESS)
-		return res;
-	device->usbInfo.vid = report[8] | report[9]<<8;
-	device->usbInfo.pid = report[10] | report[11]<<8;
-	device->usbInfo.powerSource = (report[12] & 0x40) ? MCP2221_PWRSRC_SELFPOWERED : MCP2221_PWRSRC_BUSPOWERED;
-	device->usbInfo.remoteWakeup = (report[12] & 0x20) ? MCP2221_WAKEUP_ENABLED : MCP2221_WAKEUP_DISABLED;
-	device->usbInfo.milliamps = report[13] * 2;
-
-	return MCP2221_SUCCESS;
+	response_queue_t* pending = &device->priv->pending;
+	for(int i=0;i<pending->count;i++)
+		responseQueuePush(&device->priv->owed, pending->types[i]);
+	pending->count = 0;
 }
 
-// Open handle to device
-static mcp2221_t* open(char* devPath)
+static mcp2221_error doAttempt(mcp2221_t* device, uint8_t* report, int timeout)
 {
-	if(!devPath)
-		return NULL;
+	int adaptive = (timeout == MCP2221_TIMEOUT_ADAPTIVE);
+	if(adaptive)
+		timeout = adaptiveTimeout(device);
 
-	// Open device
-	hid_device* handle = hid_open_path(devPath);
-	if(!handle)
-		return NULL;
-
-	// TODO use strdup?
-
-	// Store device info
-	mcp2221_t* device = calloc(1, sizeof(mcp2221_t));
-	device->handle = handle;
-	device->path = malloc(strlen(devPath) + 1);
-	strcpy(device->path, devPath);
+	abandonPending(device);
 
+	uint64_t start = timeMicros();
+	uint8_t type = report[0];
 	mcp2221_error res;
-	if((res = updateGPIOCache(device)) != MCP2221_SUCCESS || (res = getUSBInfo(device)) != MCP2221_SUCCESS)
+	if((res = USBsend(device, report)) == MCP2221_SUCCESS)
 	{
-		mcp2221_close(device);
-		return NULL;
+		// Whatever time is left until the deadline
+		int remaining = timeout;
+		if(timeout > 0)
+		{
+			int elapsed = (timeMicros() - start) / 1000;
+			remaining = (elapsed < timeout) ? timeout - elapsed : 0;
+		}
+		res = getResponse(device, report, type, remaining);
 	}
 
-	return device;
-}
-
-// Init, must be called before anything else!
-mcp2221_error LIB_EXPORT mcp2221_init()
-{
-	clearUsbDevList();
-
-	int res = hid_init();
-	if(res < 0)
+	if(res == MCP2221_SUCCESS)
 	{
-		debug_puts("HIDAPI Init failed");
-		return MCP2221_ERROR_HID;
+		updateRTT(device, timeMicros() - start);
+		res = checkStatus(device, report);
 	}
+	else if(res == MCP2221_ERROR_TIMEOUT && adaptive)
+		backoffRTT(device);
 
-	return MCP2221_SUCCESS;
+	return res;
 }
 
-void LIB_EXPORT mcp2221_exit()
+static void sleepMillis(int ms)
 {
-	clearUsbDevList();
-	hid_exit();
-	
-	// TODO return errors from hid_exit
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	while(nanosleep(&ts, &ts) != 0);
+#endif
 }
 
-static int checkThing(wchar_t* val1, wchar_t* val2)
+// Requests that only read something, so sending them again does no harm
+static int isIdempotent(const uint8_t* report)
 {
-	if(!val2)
-		return 1;
-	else if(!val1 && val2)
-		return 0;
-	else if(wcscmp(val1, val2) == 0)
-		return 1;
-	return 0;
+	switch(report[0])
+	{
+		case USB_CMD_GETGPIO:
+		case USB_CMD_GETSRAM:
+		case USB_CMD_READFLASH:
+			return 1;
+		case USB_CMD_STATUSSET: // Unless it's cancelling an I2C transfer or changing the I2C speed
+			return !report[2] && !report[3];
+		default:
+			return 0;
+	}
 }
 
-int LIB_EXPORT mcp2221_find(int vid, int pid, wchar_t* manufacturer, wchar_t* product, wchar_t* serial)
+static mcp2221_error doTransactionTimeout(mcp2221_t* device, uint8_t* report, int timeout)
 {
-	int count = 0;
+	if(!device)
+		return MCP2221_INVALID_ARG;
 
-	clearUsbDevList();
+	int retries = isIdempotent(report) ? device->priv->retries : 0;
+	if(!retries)
+		return doAttempt(device, report, timeout);
 
-	struct hid_device_info* allDevices = hid_enumerate(vid, pid);
-	struct hid_device_info* currentDevice;
-	currentDevice = allDevices;
+	// The response overwrites the request, keep the bit of it that matters for another go
+	uint8_t request[RETRY_PREFIX];
+	memcpy(request, report, RETRY_PREFIX);
 
-	while (currentDevice)
+	int backoff = device->priv->retryBackoff;
+	mcp2221_error res;
+	for(int attempt=0;;attempt++)
 	{
-		debug_printf("Device Found\n  type: %04hx %04hx\n  path: %s\n  serial_number: %ls", currentDevice->vendor_id, currentDevice->product_id, currentDevice->path, currentDevice->serial_number ? currentDevice->serial_number : L"(NONE)");
-		debug_printf("\n");
-		debug_printf("  Manufacturer: %ls\n", currentDevice->manufacturer_string);
-		debug_printf("  Product:      %ls\n", currentDevice->product_string);
-		debug_printf("  Release:      %hx\n", currentDevice->release_number);
-		debug_printf("  Interface:    %d\n",  currentDevice->interface_number);
-		debug_printf("\n");
-
-		if(
-			checkThing(currentDevice->manufacturer_string, manufacturer) &&
-			checkThing(currentDevice->product_string, product) &&
-			checkThing(currentDevice->serial_number, serial)
-		)
+		res = doAttempt(device, report, timeout);
+		if(res == MCP2221_SUCCESS)
 		{
-			addUsbDevList(count, currentDevice);
-			count++;
+			if(attempt)
+				device->priv->stats.recovered++;
+			break;
 		}
-		currentDevice = currentDevice->next;
-	}
+		else if((res != MCP2221_ERROR_HID && res != MCP2221_ERROR_TIMEOUT) || attempt >= retries)
+			break;
 
-	hid_free_enumeration(allDevices);
+		// Random jitter so lots of devices on the same hub don't all retry at once
+		if(backoff > 0)
+			sleepMillis((backoff / 2) + (timeMicros() % ((backoff / 2) + 1)));
+		backoff = (backoff * 2 < RETRY_BACKOFF_MAX) ? backoff * 2 : RETRY_BACKOFF_MAX;
+
+		debug_printf("Retrying %02hhx (%d)\n", request[0], attempt + 1);
+		device->priv->stats.retries++;
+		memcpy(report, request, RETRY_PREFIX);
+		memset(report + RETRY_PREFIX, 0x00, REPORT_SIZE - RETRY_PREFIX);
+	}
 
-	return count;
+	return res;
 }
 
-int LIB_EXPORT mcp2221_sameDevice(mcp2221_t* dev1, mcp2221_t* dev2)
+// Send a bunch of reports, keeping up to PIPELINE_DEPTH of them in flight
+// The MCP2221 processes commands in order, so responses come back in the same order as the reports were sent
+// A failed status doesn't stop the rest, they're already on their way
+static mcp2221_error doPipeline(mcp2221_t* device, mcp2221_report_t* reports, int count, int timeout)
 {
-	if(!dev1 || !dev2)
-		return 0;
-	else if(!dev1->path || !dev2->path)
-		return 0;
+	if(!device || !reports || count < 0)
+		return MCP2221_INVALID_ARG;
 
-	return strcmp(dev1->path, dev2->path) == 0;
-}
+	if(timeout == MCP2221_TIMEOUT_ADAPTIVE)
+		timeout = adaptiveTimeout(device);
 
-// Open first MCP2221 found
-mcp2221_t* LIB_EXPORT mcp2221_open()
-{
-	if(devList)
-		return open(devList->devPath);
-	return NULL;
-}
+	abandonPending(device);
 
-mcp2221_t* LIB_EXPORT mcp2221_open_byIndex(int idx)
-{
-	// Find device with ID
-	char* devPath = NULL;
-	for(device_list_t* dev = devList; dev; dev = dev->next)
+	mcp2221_error res;
+	mcp2221_error status = MCP2221_SUCCESS;
+	int sent = 0;
+	int next = 0; // Oldest report still waiting for a response
+	while(next < count)
 	{
-		if(dev->id == idx)
+		for(;sent < count && sent - next < PIPELINE_DEPTH;sent++)
 		{
-			devPath = dev->devPath;
-			break;
+			if((res = USBsend(device, reports[sent].data)) != MCP2221_SUCCESS)
+			{
+				// Responses for these will still turn up
+				for(int i=next;i<sent;i++)
+					responseQueuePush(&device->priv->owed, reports[i].data[0]);
+				return res;
+			}
 		}
+
+		// The report has already been sent, so the response can go straight into its buffer
+		uint8_t* report = reports[next].data;
+		if((res = getResponse(device, report, report[0], timeout)) != MCP2221_SUCCESS)
+		{
+			for(int i=next+1;i<sent;i++)
+				responseQueuePush(&device->priv->owed, reports[i].data[0]);
+			return res;
+		}
+
+		if(checkStatus(device, report) != MCP2221_SUCCESS)
+			status = MCP2221_ERROR_STATUS;
+		next++;
 	}
 
-	return open(devPath);
+	return status;
 }
 
-mcp2221_t* LIB_EXPORT mcp2221_open_bySerial(wchar_t* serial)
+static mcp2221_error doTransaction(mcp2221_t* device, uint8_t* report)
 {
-	if(!serial)
-		return NULL;
-
-	char* devPath = NULL;
-	for(device_list_t* dev = devList; dev; dev = dev->next)
+	if(!device)
+		return MCP2221_INVALID_ARG;
+	return doTransactionTimeout(device, report, device->priv->timeout);
+}
+
+// Copy of the flash sections, in READFLASH response format
+// Used by the flash cache (mcp2221_setFlashCache()) and edit sessions (mcp2221_flashBegin())
+typedef struct{
+	uint8_t data[FLASH_SECTION_COUNT][REPORT_SIZE];
+	uint8_t loaded;	// Bit for each section in data[]
+	uint8_t dirty;	// Bit for each section changed in a session but not written yet
+	int session;	// mcp2221_flashBegin() has been called
+}flash_image_t;
+
+#define FLASH_ALL_SECTIONS	((1<<FLASH_SECTION_COUNT) - 1)
+
+static flash_image_t* getFlashImage(mcp2221_t* device)
+{
+	if(!device->priv->flash)
+		device->priv->flash = calloc(1, sizeof(flash_image_t));
+	return device->priv->flash;
+}
+
+// READFLASH responses have the length and a don't care byte before the chip and GPIO settings, WRITEFLASH reports don't
+// Descriptors have the length and 0x03 in both
+static int flashDataOffset(uint8_t section)
+{
+	return (section == FLASH_SECTION_CHIPSETTINGS || section == FLASH_SECTION_GPIOSETTINGS) ? 2 : 0;
+}
+
+// Update the image with the contents of a WRITEFLASH report
+static void flashStore(flash_image_t* image, const uint8_t* report)
+{
+	uint8_t section = report[1];
+	int offset = flashDataOffset(section);
+	uint8_t* data = image->data[section];
+	if(!(image->loaded & (1<<section)))
+	{
+		clearReport(data);
+		data[0] = USB_CMD_READFLASH;
+		data[1] = section;
+	}
+	memcpy(&data[2 + offset], &report[2], REPORT_SIZE - 2 - offset);
+	image->loaded |= 1<<section;
+}
+
+// Read every section that isn't in the image yet, all in one pipeline
+static mcp2221_error loadFlashImage(mcp2221_t* device, flash_image_t* image)
+{
+	mcp2221_report_t reports[FLASH_SECTION_COUNT];
+	uint8_t sections[FLASH_SECTION_COUNT];
+	int count = 0;
+
+	for(int i=0;i<FLASH_SECTION_COUNT;i++)
+	{
+		if(image->loaded & (1<<i))
+			continue;
+		setReport(device, reports[count].data, USB_CMD_READFLASH);
+		reports[count].data[1] = i;
+		sections[count++] = i;
+	}
+
+	if(!count)
+		return MCP2221_SUCCESS;
+
+	mcp2221_error res;
+	if((res = doPipeline(device, reports, count, device->priv->timeout)) != MCP2221_SUCCESS)
+		return res;
+
+	for(int i=0;i<count;i++)
+	{
+		memcpy(image->data[sections[i]], reports[i].data, REPORT_SIZE);
+		image->loaded |= 1<<sections[i];
+	}
+
+	return MCP2221_SUCCESS;
+}
+
+// Read a flash section into a READFLASH response
+// With the flash cache enabled this comes from the image, in a session each section is only read from the device once
+static mcp2221_error flashRead(mcp2221_t* device, flash_section_t section, uint8_t* report)
+{
+	mcp2221_error res;
+	if((res = setReport(device, report, USB_CMD_READFLASH)) != MCP2221_SUCCESS)
+		return res;
+	report[1] = section;
+
+	flash_image_t* image = device->priv->flash;
+	if(device->priv->flashCache)
+	{
+		if(!image && !(image = getFlashImage(device)))
+			return MCP2221_ERROR;
+		if((res = loadFlashImage(device, image)) != MCP2221_SUCCESS)
+			return res;
+	}
+	else if(!image || !image->session)
+		return doTransaction(device, report);
+
+	if(!(image->loaded & (1<<section)))
+	{
+		if((res = doTransaction(device, report)) != MCP2221_SUCCESS)
+			return res;
+		memcpy(image->data[section], report, REPORT_SIZE);
+		image->loaded |= 1<<section;
+	}
+
+	memcpy(report, image->data[section], REPORT_SIZE);
+	return MCP2221_SUCCESS;
+}
+
+// Send a WRITEFLASH report to the device
+static mcp2221_error sendFlashWrite(mcp2221_t* device, uint8_t* report)
+{
+	// Writing the chip settings with password protection on also sets the password, so make sure it stays the same
+	if(report[1] == FLASH_SECTION_CHIPSETTINGS && (report[2] & 0x03) == MCP2221_SECURITY_PASSWORD)
+		memcpy(&report[12], device->priv->flashPassword, MCP2221_PASSWORD_LEN);
+
+	mcp2221_error res = doTransaction(device, report);
+	if(res == MCP2221_ERROR_STATUS && report[1] == 0x03) // Not allowed, needs unlocking or permanently locked
+		res = MCP2221_ERROR_ACCESS;
+	return res;
+}
+
+// Send a WRITEFLASH report, or if a session is open just update the image and leave it for mcp2221_flashCommit()
+static mcp2221_error flashWrite(mcp2221_t* device, uint8_t* report)
+{
+	uint8_t section = report[1];
+	flash_image_t* image = device->priv->flash;
+	if(image && image->session)
+	{
+		flashStore(image, report);
+		image->dirty |= 1<<section;
+		return MCP2221_SUCCESS;
+	}
+
+	if(!image || !device->priv->flashCache)
+		return sendFlashWrite(device, report);
+
+	// The response overwrites the report, so update the image first and forget the section if the write fails
+	flashStore(image, report);
+	mcp2221_error res = sendFlashWrite(device, report);
+	if(res != MCP2221_SUCCESS)
+		image->loaded &= ~(1<<section);
+	return res;
+}
+
+// Reads FLASH data for updating
+static mcp2221_error saveReport(mcp2221_t* device, uint8_t* report)
+{
+	return flashRead(device, FLASH_SECTION_CHIPSETTINGS, report);
+}
+
+static void saveReportUpdate(uint8_t* report, uint8_t* reportUpdate)
+{
+	clearReport(reportUpdate);
+	memcpy(reportUpdate, &report[2], REPORT_SIZE - 2);
+	reportUpdate[0] = USB_CMD_WRITEFLASH;
+	reportUpdate[1] = FLASH_SECTION_CHIPSETTINGS;
+}
+
+// USB descriptors are 16-bit unicode characters, but wchar_t can be bigger than that (32-bit on Linux) so convert each character
+static void descriptorToWide(wchar_t* dest, const uint8_t* src, int len)
+{
+	for(int i=0;i<len;i++)
+		dest[i] = src[i * 2] | (src[(i * 2) + 1]<<8);
+	dest[len] = L'\0'; // Make sure string is null terminated
+}
+
+static void wideToDescriptor(uint8_t* dest, const wchar_t* src, int len)
+{
+	for(int i=0;i<len;i++)
+	{
+		dest[i * 2] = src[i];
+		dest[(i * 2) + 1] = src[i]>>8;
+	}
+}
+
+static void decodeDescriptor(uint8_t* report, wchar_t* dest)
+{
+	// USB descriptors do not contain a null terminator
+	// report[2] is the number of bytes + 2, which is double the number of characters + 1 extra
+	int len = (report[2] / 2) - 1;
+
+	if(len > MCP2221_STR_LEN - 1)
+		len = MCP2221_STR_LEN - 1;
+	else if(len < 1) // Empty string
+		len = 0;
+
+	descriptorToWide(dest, &report[4], len);
+}
+
+static mcp2221_error setDescriptor(mcp2221_t* device, wchar_t* buffer, flash_section_t section)
+{
+	if(!buffer)
+		return MCP2221_INVALID_ARG;
+
+	NEW_REPORT(report);
+	mcp2221_error res;
+	if((res = setReport(device, report, USB_CMD_WRITEFLASH)) != MCP2221_SUCCESS)
+		return res;
+
+	int len = wcslen(buffer);
+
+	if(len > MCP2221_STR_LEN - 1)
+		len = MCP2221_STR_LEN - 1;
+
+	report[1] = section;
+	report[2] = (len * 2) + 2;
+	report[3] = 0x03;
+	wideToDescriptor(&report[4], buffer, len);
+
+	res = flashWrite(device, report);
+	return res;
+}
+
+// Reads through the flash session if there is one
+static mcp2221_error getDescriptor(mcp2221_t* device, wchar_t* buffer, flash_section_t section)
+{
+	NEW_REPORT(report);
+	mcp2221_error res;
+	if((res = flashRead(device, section, report)) != MCP2221_SUCCESS)
+		return res;
+	decodeDescriptor(report, buffer);
+	return res;
+}
+
+// Keep a copy of a GETSRAM response for the getters to use when the SRAM cache is enabled
+static void storeSRAM(mcp2221_t* device, const uint8_t* report)
+{
+	memcpy(device->priv->sram, report, REPORT_SIZE);
+	device->priv->sramValid = 1;
+	device->priv->sramGeneration++;
+
+	for(int i=0;i<MCP2221_GPIO_COUNT;i++)
+		device->gpioCache[i] = report[22 + i];
+}
+
+static mcp2221_error readSRAM(mcp2221_t* device, uint8_t* report)
+{
+	mcp2221_error res;
+	if((res = setReport(device, report, USB_CMD_GETSRAM)) != MCP2221_SUCCESS)
+		return res;
+	res = doTransaction(device, report);
+	if(res == MCP2221_SUCCESS)
+		storeSRAM(device, report);
+	return res;
+}
+
+// Get SRAM settings in GETSRAM response format, from the cached copy if it's enabled
+static mcp2221_error getSRAM(mcp2221_t* device, uint8_t* report)
+{
+	if(!device)
+		return MCP2221_INVALID_ARG;
+	else if(device->priv->sramCache && device->priv->sramValid)
+	{
+		memcpy(report, device->priv->sram, REPORT_SIZE);
+		return MCP2221_SUCCESS;
+	}
+	return readSRAM(device, report);
+}
+
+// Apply the changes from a SETSRAM report to the cached copy, same as what the MCP2221 does with it
+static void applySRAM(mcp2221_t* device, const uint8_t* report)
+{
+	uint8_t* sram = device->priv->sram;
+
+	if(report[2] & 0x80) // Clock output
+		sram[5] = report[2] & 0x1F;
+
+	if(report[3] & 0x80) // DAC reference
+		sram[6] = (sram[6] & 0x1F) | ((report[3] & 0x07)<<5);
+
+	if(report[4] & 0x80) // DAC value
+		sram[6] = (sram[6] & 0xE0) | (report[4] & 0x1F);
+
+	if(report[5] & 0x80) // ADC reference
+		sram[7] = (sram[7] & ~0x1C) | ((report[5] & 0x07)<<2);
+
+	if(report[6] & 0x80) // Interrupt edges
+	{
+		if(report[6] & 0x10)
+			sram[7] = (sram[7] & ~0x20) | ((report[6] & 0x08) ? 0x20 : 0);
+		if(report[6] & 0x04)
+			sram[7] = (sram[7] & ~0x40) | ((report[6] & 0x02) ? 0x40 : 0);
+	}
+
+	if(report[7] & 0x80) // GPIO
+	{
+		memcpy(&sram[22], &report[8], MCP2221_GPIO_COUNT);
+		memcpy(device->gpioCache, &report[8], MCP2221_GPIO_COUNT);
+	}
+
+	device->priv->sramGeneration++;
+}
+
+// Clear the apply bits of any SETSRAM sections that wouldn't change anything, returns 0 if there's nothing left to send
+static int stripSRAM(mcp2221_t* device, uint8_t* report)
+{
+	const uint8_t* sram = device->priv->sram;
+
+	if((report[2] & 0x80) && sram[5] == (report[2] & 0x1F))
+		report[2] = 0;
+
+	if((report[3] & 0x80) && (sram[6]>>5) == (report[3] & 0x07))
+		report[3] = 0;
+
+	if((report[4] & 0x80) && (sram[6] & 0x1F) == (report[4] & 0x1F))
+		report[4] = 0;
+
+	if((report[5] & 0x80) && ((sram[7]>>2) & 0x07) == (report[5] & 0x07))
+		report[5] = 0;
+
+	// Clearing the interrupt flag always has to be sent
+	if((report[6] & 0x80) && !(report[6] & 0x01))
+	{
+		int rising = !(report[6] & 0x10) || !!(sram[7] & 0x20) == !!(report[6] & 0x08);
+		int falling = !(report[6] & 0x04) || !!(sram[7] & 0x40) == !!(report[6] & 0x02);
+		if(rising && falling)
+			report[6] = 0;
+	}
+
+	if((report[7] & 0x80) && !memcmp(&sram[22], &report[8], MCP2221_GPIO_COUNT))
+		report[7] = 0;
+
+	for(int i=2;i<8;i++)
+	{
+		if(report[i] & 0x80)
+			return 1;
+	}
+	return 0;
+}
+
+// Send a SETSRAM report and update the cached copy to match
+static mcp2221_error setSRAM(mcp2221_t* device, uint8_t* report)
+{
+	if(device->priv->suppressWrites && device->priv->sramValid && !stripSRAM(device, report))
+	{
+		device->priv->stats.suppressedWrites++;
+		return MCP2221_SUCCESS;
+	}
+
+	// The response overwrites the report
+	uint8_t changes[8 + MCP2221_GPIO_COUNT];
+	memcpy(changes, report, sizeof(changes));
+
+	mcp2221_error res = doTransaction(device, report);
+	if(res == MCP2221_SUCCESS)
+		applySRAM(device, changes);
+	else
+		device->priv->sramValid = 0; // Don't know what the device has now
+	return res;
+}
+
+// Fill in usbInfo
+// The factory serial and GETSRAM parts are always done when opening, lazy opens leave the descriptors and status part until
+// mcp2221_getUSBInfo() is called. The factory serial is needed straight away for the context's registry.
+static mcp2221_error getUSBInfo(mcp2221_t* device, int sram, int rest)
+{
+	// All of these are independent reads, so send them all at once
+	mcp2221_report_t reports[6];
+	int count = 0;
+	if(rest)
+	{
+		setReport(device, reports[count].data, USB_CMD_READFLASH);
+		reports[count++].data[1] = FLASH_SECTION_USBMANUFACTURER;
+		setReport(device, reports[count].data, USB_CMD_READFLASH);
+		reports[count++].data[1] = FLASH_SECTION_USBPRODUCT;
+		setReport(device, reports[count].data, USB_CMD_READFLASH);
+		reports[count++].data[1] = FLASH_SECTION_USBSERIAL;
+		setReport(device, reports[count++].data, USB_CMD_STATUSSET);
+	}
+	if(sram)
+	{
+		setReport(device, reports[count].data, USB_CMD_READFLASH);
+		reports[count++].data[1] = FLASH_SECTION_FACTORYSERIAL;
+		setReport(device, reports[count++].data, USB_CMD_GETSRAM);
+	}
+
+	mcp2221_error res;
+	if((res = doPipeline(device, reports, count, device->priv->timeout)) != MCP2221_SUCCESS)
+		return res;
+
+	uint8_t* report;
+	if(rest)
+	{
+		decodeDescriptor(reports[0].data, device->usbInfo.manufacturer);
+		decodeDescriptor(reports[1].data, device->usbInfo.product);
+		decodeDescriptor(reports[2].data, device->usbInfo.serial);
+
+		// Firmware and hardware version
+		report = reports[3].data;
+		device->usbInfo.hardware[0] = report[46];
+		device->usbInfo.hardware[1] = report[47];
+		device->usbInfo.firmware[0] = report[48];
+		device->usbInfo.firmware[1] = report[49];
+
+		device->priv->usbInfoLoaded = 1;
+	}
+
+	if(sram)
+	{
+		// Factory serial
+		report = reports[count - 2].data;
+		device->usbInfo.factorySerialLen = report[2];
+		if(device->usbInfo.factorySerialLen > sizeof(device->usbInfo.factorySerial) - 1)
+			device->usbInfo.factorySerialLen = sizeof(device->usbInfo.factorySerial) - 1;
+		memcpy(device->usbInfo.factorySerial, &report[4], device->usbInfo.factorySerialLen);
+		device->usbInfo.factorySerial[device->usbInfo.factorySerialLen] = 0x00; // Make sure we're null terminated
+
+		// VID & PID, and fill the SRAM cache while we're at it
+		report = reports[count - 1].data;
+		storeSRAM(device, report);
+		device->usbInfo.vid = report[8] | report[9]<<8;
+		device->usbInfo.pid = report[10] | report[11]<<8;
+		device->usbInfo.powerSource = (report[12] & 0x40) ? MCP2221_PWRSRC_SELFPOWERED : MCP2221_PWRSRC_BUSPOWERED;
+		device->usbInfo.remoteWakeup = (report[12] & 0x20) ? MCP2221_WAKEUP_ENABLED : MCP2221_WAKEUP_DISABLED;
+		device->usbInfo.milliamps = report[13] * 2;
+	}
+
+	return MCP2221_SUCCESS;
+}
+
+// Error code for why opening failed goes into error
+mcp2221_t* openTransport(mcp2221_ctx_t* ctx, const mcp2221_transport_t* transport, void* handle, const char* path, mcp2221_error* error)
+{
+	if(!transport || !handle)
+	{
+		*error = MCP2221_INVALID_ARG;
+		return NULL;
+	}
+
+	// TODO use strdup?
+
+	// Store device info
+	mcp2221_t* device = calloc(1, sizeof(mcp2221_t));
+	struct mcp2221_private_t* priv = calloc(1, sizeof(struct mcp2221_private_t));
+	if(!device || !priv)
+	{
+		free(device);
+		free(priv);
+		transport->close(handle);
+		*error = MCP2221_ERROR;
+		return NULL;
+	}
+	device->handle = handle;
+	device->priv = priv;
+	device->priv->transport = transport;
+	device->priv->retries = RETRY_DEFAULT;
+	device->priv->retryBackoff = RETRY_BACKOFF;
+	if(path)
+	{
+		device->path = malloc(strlen(path) + 1);
+		strcpy(device->path, path);
+	}
+
+	if((*error = getUSBInfo(device, 1, !(ctx && ctx->lazyOpen))) != MCP2221_SUCCESS)
+	{
+		mcp2221_close(device);
+		return NULL;
+	}
+
+	// Now the device can be found by its factory serial too
+	// Done here so the device doesn't need to keep hold of the context, which might be destroyed before the device is closed
+	if(path && ctx)
+		registrySetFactorySerial(ctx->registry, path, device->usbInfo.factorySerial);
+
+	return device;
+}
+
+mcp2221_t* LIB_EXPORT mcp2221_open_transport(const mcp2221_transport_t* transport, void* handle, const char* path)
+{
+	mcp2221_error error;
+	return openTransport(getDefaultCtx(), transport, handle, path, &error);
+}
+
+// Open handle to device
+static mcp2221_t* open(mcp2221_ctx_t* ctx, char* devPath, mcp2221_error* error)
+{
+	if(!devPath)
+	{
+		*error = MCP2221_INVALID_ARG;
+		return NULL;
+	}
+
+#ifdef MCP2221_HIDRAW
+	return hidraw_open(ctx, devPath, error);
+#else
+	// Open device
+	hid_device* handle = hid_open_path(devPath);
+	if(!handle)
+	{
+		*error = MCP2221_ERROR_HID;
+		return NULL;
+	}
+
+	return openTransport(ctx, &hidTransport, handle, devPath, error);
+#endif
+}
+
+// Init, must be called before anything else!
+mcp2221_error LIB_EXPORT mcp2221_init()
+{
+	if(!defaultCtx.registry && !(defaultCtx.registry = registryCreate()))
+		return MCP2221_ERROR;
+	registryClear(defaultCtx.registry);
+
+#ifndef MCP2221_HIDRAW
+	int res = hid_init();
+	if(res < 0)
+	{
+		debug_puts("HIDAPI Init failed");
+		return MCP2221_ERROR_HID;
+	}
+#endif
+
+	return MCP2221_SUCCESS;
+}
+
+void LIB_EXPORT mcp2221_exit()
+{
+	registryDestroy(defaultCtx.registry);
+	defaultCtx.registry = NULL;
+#ifndef MCP2221_HIDRAW
+	hid_exit();
+#endif
+	
+	// TODO return errors from hid_exit
+}
+
+mcp2221_ctx_t* LIB_EXPORT mcp2221_ctxCreate()
+{
+	mcp2221_ctx_t* ctx = calloc(1, sizeof(mcp2221_ctx_t));
+	if(!ctx)
+		return NULL;
+
+	ctx->registry = registryCreate();
+	if(!ctx->registry)
+	{
+		free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+void LIB_EXPORT mcp2221_ctxDestroy(mcp2221_ctx_t* ctx)
+{
+	// The default context belongs to mcp2221_init() and mcp2221_exit()
+	if(!ctx || ctx == &defaultCtx)
+		return;
+	registryDestroy(ctx->registry);
+	free(ctx);
+}
+
+void LIB_EXPORT mcp2221_ctxSetLazyOpen(mcp2221_ctx_t* ctx, int enable)
+{
+	if(ctx)
+		ctx->lazyOpen = enable;
+}
+
+void LIB_EXPORT mcp2221_setLazyOpen(int enable)
+{
+	defaultCtx.lazyOpen = enable;
+}
+
+static int checkThing(const wchar_t* val1, const wchar_t* val2)
+{
+	if(!val2)
+		return 1;
+	else if(!val1 && val2)
+		return 0;
+	else if(wcscmp(val1, val2) == 0)
+		return 1;
+	return 0;
+}
+
+typedef struct{
+	registry_t* registry;
+	wchar_t* manufacturer;
+	wchar_t* product;
+	wchar_t* serial;
+	int count;
+}find_filter_t;
+
+static void foundDevice(void* userData, const char* path, const wchar_t* manufacturer, const wchar_t* product, const wchar_t* serial)
+{
+	find_filter_t* filter = userData;
+
+	if(
+		checkThing(manufacturer, filter->manufacturer) &&
+		checkThing(product, filter->product) &&
+		checkThing(serial, filter->serial)
+	)
+	{
+		if(registryAdd(filter->registry, path, serial) >= 0)
+			filter->count++;
+	}
+}
+
+int LIB_EXPORT mcp2221_ctxFind(mcp2221_ctx_t* ctx, int vid, int pid, wchar_t* manufacturer, wchar_t* product, wchar_t* serial)
+{
+	if(!ctx)
+		return 0;
+
+	find_filter_t filter = {
+		.registry = ctx->registry,
+		.manufacturer = manufacturer,
+		.product = product,
+		.serial = serial,
+		.count = 0
+	};
+
+	registryClear(ctx->registry);
+
+#ifdef MCP2221_HIDRAW
+	hidraw_enumerate(vid, pid, foundDevice, &filter);
+#else
+	struct hid_device_info* allDevices = hid_enumerate(vid, pid);
+	struct hid_device_info* currentDevice;
+	currentDevice = allDevices;
+
+	while (currentDevice)
 	{
-		if(dev->serial && wcscmp(dev->serial, serial) == 0)
-		{
-			devPath = dev->devPath;
-			break;
-		}
+		debug_printf("Device Found\n  type: %04hx %04hx\n  path: %s\n  serial_number: %ls", currentDevice->vendor_id, currentDevice->product_id, currentDevice->path, currentDevice->serial_number ? currentDevice->serial_number : L"(NONE)");
+		debug_printf("\n");
+		debug_printf("  Manufacturer: %ls\n", currentDevice->manufacturer_string);
+		debug_printf("  Product:      %ls\n", currentDevice->product_string);
+		debug_printf("  Release:      %hx\n", currentDevice->release_number);
+		debug_printf("  Interface:    %d\n",  currentDevice->interface_number);
+		debug_printf("\n");
+
+		foundDevice(&filter, currentDevice->path, currentDevice->manufacturer_string, currentDevice->product_string, currentDevice->serial_number);
+		currentDevice = currentDevice->next;
 	}
 
-	return open(devPath);
+	hid_free_enumeration(allDevices);
+#endif
+
+	return filter.count;
+}
+
+int LIB_EXPORT mcp2221_find(int vid, int pid, wchar_t* manufacturer, wchar_t* product, wchar_t* serial)
+{
+	return mcp2221_ctxFind(getDefaultCtx(), vid, pid, manufacturer, product, serial);
+}
+
+int LIB_EXPORT mcp2221_sameDevice(mcp2221_t* dev1, mcp2221_t* dev2)
+{
+	if(!dev1 || !dev2)
+		return 0;
+	else if(!dev1->path || !dev2->path)
+		return 0;
+
+	return strcmp(dev1->path, dev2->path) == 0;
+}
+
+// Open a device from the registry
+static mcp2221_t* openPath(mcp2221_ctx_t* ctx, char* devPath, mcp2221_error* error)
+{
+	mcp2221_t* device = open(ctx, devPath, error);
+	free(devPath);
+	return device;
+}
+
+mcp2221_t* openIndex(mcp2221_ctx_t* ctx, int idx, mcp2221_error* error)
+{
+	return openPath(ctx, registryPath(ctx->registry, idx), error);
+}
+
+// Open first MCP2221 found
+mcp2221_t* LIB_EXPORT mcp2221_ctxOpen(mcp2221_ctx_t* ctx)
+{
+	return mcp2221_ctxOpen_byIndex(ctx, 0);
+}
+
+mcp2221_t* LIB_EXPORT mcp2221_ctxOpen_byIndex(mcp2221_ctx_t* ctx, int idx)
+{
+	mcp2221_error error;
+	if(!ctx)
+		return NULL;
+	return openIndex(ctx, idx, &error);
+}
+
+mcp2221_t* LIB_EXPORT mcp2221_ctxOpen_bySerial(mcp2221_ctx_t* ctx, wchar_t* serial)
+{
+	mcp2221_error error;
+	if(!ctx || !serial)
+		return NULL;
+	return openPath(ctx, registryFindSerial(ctx->registry, serial), &error);
+}
+
+mcp2221_t* LIB_EXPORT mcp2221_ctxOpen_byFactorySerial(mcp2221_ctx_t* ctx, const char* factorySerial)
+{
+	mcp2221_error error;
+	if(!ctx || !factorySerial)
+		return NULL;
+	return openPath(ctx, registryFindFactorySerial(ctx->registry, factorySerial), &error);
+}
+
+mcp2221_t* LIB_EXPORT mcp2221_open()
+{
+	return mcp2221_open_byIndex(0);
+}
+
+mcp2221_t* LIB_EXPORT mcp2221_open_byIndex(int idx)
+{
+	return mcp2221_ctxOpen_byIndex(getDefaultCtx(), idx);
+}
+
+mcp2221_t* LIB_EXPORT mcp2221_open_bySerial(wchar_t* serial)
+{
+	return mcp2221_ctxOpen_bySerial(getDefaultCtx(), serial);
+}
+
+mcp2221_t* LIB_EXPORT mcp2221_open_byFactorySerial(const char* factorySerial)
+{
+	return mcp2221_ctxOpen_byFactorySerial(getDefaultCtx(), factorySerial);
 }
 
 // Close handle
 void LIB_EXPORT mcp2221_close(mcp2221_t* device)
 {
-	if(device)
+	if(device && !asyncDeferClose(device))
 	{
-		hid_close(device->handle);
+		mcp2221_asyncStop(device);
+		free(device->priv->flash);
+		device->priv->transport->close(device->handle);
 		device->handle = NULL;
+		wipe(device->priv->flashPassword, MCP2221_PASSWORD_LEN);
+		free(device->priv);
+		free(device->path);
 		free(device);
 		//device = NULL; // needed? this isnt a pointer to a pointer
 	}
 }
 
+mcp2221_error LIB_EXPORT mcp2221_getUSBInfo(mcp2221_t* device, mcp2221_usbinfo_t* info)
+{
+	if(!device || !info)
+		return MCP2221_INVALID_ARG;
+
+	mcp2221_error res;
+	if(!device->priv->usbInfoLoaded && (res = getUSBInfo(device, 0, 1)) != MCP2221_SUCCESS)
+		return res;
+
+	*info = device->usbInfo;
+	return MCP2221_SUCCESS;
+}
+
 mcp2221_error LIB_EXPORT mcp2221_reset(mcp2221_t* device)
 {
 	NEW_REPORT(report);
@@ -566,8 +1240,11 @@ mcp2221_error LIB_EXPORT mcp2221_reset(mcp2221_t* device)
 	report[1] = 0xAB;
 	report[2] = 0xCD;
 	report[3] = 0xEF;
-	res = doTransaction(device, report);
-	return res;
+	device->priv->sramValid = 0; // SRAM gets reloaded from flash
+	device->priv->flashUnlocked = 0;
+
+	// The device resets without sending a response and comes back as a new USB device, so don't wait for anything
+	return USBsend(device, report);
 }
 
 mcp2221_error LIB_EXPORT mcp2221_isConnected(mcp2221_t* device)
@@ -586,58 +1263,286 @@ mcp2221_error LIB_EXPORT mcp2221_isConnected(mcp2221_t* device)
 
 mcp2221_error LIB_EXPORT mcp2221_rawReport(mcp2221_t* device, uint8_t* report)
 {
-	return doTransaction(device, report);
+	if(!report)
+		return MCP2221_INVALID_ARG;
+
+	// Caller's buffer doesn't have room for the report ID
+	NEW_REPORT(buff);
+	memcpy(buff, report, REPORT_SIZE);
+	mcp2221_error res = doTransaction(device, buff);
+	memcpy(report, buff, REPORT_SIZE);
+	return res;
 }
 
-mcp2221_error LIB_EXPORT mcp2221_setClockOut(mcp2221_t* device, mcp2221_clkdiv_t div, mcp2221_clkduty_t duty)
+mcp2221_error LIB_EXPORT mcp2221_rawReportTimeout(mcp2221_t* device, mcp2221_report_t* report, int timeout)
 {
-	NEW_REPORT(report);
-	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_SETSRAM)) != MCP2221_SUCCESS)
-		return res;
-	report[2] = 0x80 | duty | div;
-	res = doTransaction(device, report);
-	return res;
+	if(!report)
+		return MCP2221_INVALID_ARG;
+	return doTransactionTimeout(device, report->data, timeout);
 }
 
-mcp2221_error LIB_EXPORT mcp2221_getClockOut(mcp2221_t* device, mcp2221_clkdiv_t* div, mcp2221_clkduty_t* duty)
+mcp2221_error LIB_EXPORT mcp2221_rawPipeline(mcp2221_t* device, mcp2221_report_t* reports, int count)
 {
-	NEW_REPORT(report);
-	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_GETSRAM)) != MCP2221_SUCCESS)
-		return res;
-	res = doTransaction(device, report);
+	return doPipeline(device, reports, count, device ? device->priv->timeout : 0);
+}
+
+int LIB_EXPORT mcp2221_getPollFd(mcp2221_t* device)
+{
+	if(!device || !device->priv->transport->pollFd)
+		return -1;
+	return device->priv->transport->pollFd(device->handle);
+}
+
+mcp2221_error LIB_EXPORT mcp2221_submitReport(mcp2221_t* device, mcp2221_report_t* report)
+{
+	if(!device || !report)
+		return MCP2221_INVALID_ARG;
+	else if(device->priv->pending.count >= RESPONSE_QUEUE_SIZE)
+		return MCP2221_ERROR;
+
+	mcp2221_error res = USBsend(device, report->data);
 	if(res == MCP2221_SUCCESS)
-	{
-		*div = report[5] & 0x07;
-		*duty = report[5] & 0x18;
-	}
+		responseQueuePush(&device->priv->pending, report->data[0]);
 	return res;
 }
 
-mcp2221_error LIB_EXPORT mcp2221_setDAC(mcp2221_t* device, mcp2221_dac_ref_t ref, int value)
+mcp2221_error LIB_EXPORT mcp2221_completeReport(mcp2221_t* device, mcp2221_report_t* report)
 {
-	NEW_REPORT(report);
+	if(!device || !report)
+		return MCP2221_INVALID_ARG;
+	else if(!device->priv->pending.count) // Nothing to complete, or a blocking request has already thrown the responses away
+		return MCP2221_ERROR;
+
+	// Same matching as getResponse(), but without waiting
+	uint8_t type = device->priv->pending.types[0];
+	int stale = 0;
 	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_SETSRAM)) != MCP2221_SUCCESS)
+	while((res = USBget(device, report->data, 0)) == MCP2221_SUCCESS && isStaleResponse(device, report->data, type))
+		stale = 1;
+
+	if(res != MCP2221_SUCCESS)
 		return res;
+
+	if(stale)
+		device->priv->stats.resyncs++;
+	responseQueueDrop(&device->priv->pending, 1);
+
+	return checkStatus(device, report->data);
+}
+
+mcp2221_error LIB_EXPORT mcp2221_getStats(mcp2221_t* device, mcp2221_stats_t* stats)
+{
+	if(!device || !stats)
+		return MCP2221_INVALID_ARG;
+	*stats = device->priv->stats;
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_clearStats(mcp2221_t* device)
+{
+	if(!device)
+		return MCP2221_INVALID_ARG;
+	memset(&device->priv->stats, 0x00, sizeof(mcp2221_stats_t));
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_setRetry(mcp2221_t* device, int retries, int backoff)
+{
+	if(!device || retries < 0 || backoff < 0)
+		return MCP2221_INVALID_ARG;
+	device->priv->retries = retries;
+	device->priv->retryBackoff = backoff;
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_setTimeout(mcp2221_t* device, int timeout)
+{
+	if(!device || timeout < MCP2221_TIMEOUT_INFINITE)
+		return MCP2221_INVALID_ARG;
+	device->priv->timeout = timeout;
+	return MCP2221_SUCCESS;
+}
+
+int LIB_EXPORT mcp2221_getTimeout(mcp2221_t* device)
+{
+	if(!device)
+		return MCP2221_INVALID_ARG;
+	else if(device->priv->timeout == MCP2221_TIMEOUT_ADAPTIVE)
+		return adaptiveTimeout(device);
+	return device->priv->timeout;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_setWriteSuppression(mcp2221_t* device, int enable)
+{
+	if(!device)
+		return MCP2221_INVALID_ARG;
+	device->priv->suppressWrites = enable;
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_setSRAMCache(mcp2221_t* device, int enable)
+{
+	if(!device)
+		return MCP2221_INVALID_ARG;
+	device->priv->sramCache = enable;
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_refreshSRAM(mcp2221_t* device)
+{
+	NEW_REPORT(report);
+	return readSRAM(device, report);
+}
+
+uint32_t LIB_EXPORT mcp2221_getSRAMGeneration(mcp2221_t* device)
+{
+	if(!device)
+		return 0;
+	return device->priv->sramGeneration;
+}
+
+mcp2221_sramupdate_t LIB_EXPORT mcp2221_SRAMUpdateInit()
+{
+	mcp2221_sramupdate_t update;
+	memset(&update, 0x00, sizeof(mcp2221_sramupdate_t));
+	update.report.data[0] = USB_CMD_SETSRAM;
+	return update;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_SRAMUpdateClockOut(mcp2221_sramupdate_t* update, mcp2221_clkdiv_t div, mcp2221_clkduty_t duty)
+{
+	if(!update)
+		return MCP2221_INVALID_ARG;
+	update->report.data[2] = 0x80 | duty | div;
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_SRAMUpdateDAC(mcp2221_sramupdate_t* update, mcp2221_dac_ref_t ref, int value)
+{
+	if(!update)
+		return MCP2221_INVALID_ARG;
 	if(value < 0)
 		value = 0;
 	else if(value > MCP2221_DAC_MAX)
 		value = MCP2221_DAC_MAX;
-	report[3] = 0x80 | ref;
-	report[4] = 0x80 | value;
-	res = doTransaction(device, report);
+	update->report.data[3] = 0x80 | ref;
+	update->report.data[4] = 0x80 | value;
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_SRAMUpdateADC(mcp2221_sramupdate_t* update, mcp2221_adc_ref_t ref)
+{
+	if(!update)
+		return MCP2221_INVALID_ARG;
+	update->report.data[5] = 0x80 | ref;
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_SRAMUpdateInterrupt(mcp2221_sramupdate_t* update, mcp2221_int_trig_t trig, int clearInt)
+{
+	if(!update)
+		return MCP2221_INVALID_ARG;
+	uint8_t* report = update->report.data;
+	report[6] = 0x80 | 0x04 | 0x10 | trig;
+	if(clearInt)
+		report[6] |= 1;
+	return MCP2221_SUCCESS;
+}
+
+// GPIO setting byte, same layout in SRAM and flash
+// Direction and value only mean something in GPIO mode, for anything else they end up as output low
+uint8_t gpioConfValue(const mcp2221_gpioconf_t* conf)
+{
+	uint8_t val = 0;
+
+	if(conf->value == MCP2221_GPIO_VALUE_HIGH)
+		val |= 16;
+
+	if(conf->direction == MCP2221_GPIO_DIR_INPUT)
+		val |= 8;
+
+	val |= conf->mode;
+
+	return val;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_SRAMUpdateGPIOConf(mcp2221_t* device, mcp2221_sramupdate_t* update, mcp2221_gpioconfset_t* confSet)
+{
+	if(!device || !update || !confSet)
+		return MCP2221_INVALID_ARG;
+
+	uint8_t* report = update->report.data;
+
+	// Load current GPIO settings, unless some changes have already been staged
+	// When writing GPIO stuff to SRAM all GPIOs must be reconfigured, even if we only want to change one
+	// Instead of reading from the device we store GPIO settings locally to speed things up a bit
+	if(!(report[7] & 0x80))
+	{
+		for(int i=0;i<MCP2221_GPIO_COUNT;i++)
+			report[8 + i] = device->gpioCache[i];
+	}
+
+	report[7] = 0x80; // datasheet says this should be 1, but should actually be 0x80
+
+	for(int i=0;i<MCP2221_GPIO_COUNT;i++)
+	{
+		uint8_t val = gpioConfValue(&confSet->conf[i]);
+
+		if(confSet->conf[i].gpios & MCP2221_GPIO0)
+			report[8] = val;
+
+		if(confSet->conf[i].gpios & MCP2221_GPIO1)
+			report[9] = val;
+
+		if(confSet->conf[i].gpios & MCP2221_GPIO2)
+			report[10] = val;
+
+		if(confSet->conf[i].gpios & MCP2221_GPIO3)
+			report[11] = val;
+	}
+
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_SRAMUpdateSend(mcp2221_t* device, mcp2221_sramupdate_t* update)
+{
+	if(!device || !update)
+		return MCP2221_INVALID_ARG;
+	return setSRAM(device, update->report.data);
+}
+
+mcp2221_error LIB_EXPORT mcp2221_setClockOut(mcp2221_t* device, mcp2221_clkdiv_t div, mcp2221_clkduty_t duty)
+{
+	mcp2221_sramupdate_t update = mcp2221_SRAMUpdateInit();
+	mcp2221_SRAMUpdateClockOut(&update, div, duty);
+	return mcp2221_SRAMUpdateSend(device, &update);
+}
+
+mcp2221_error LIB_EXPORT mcp2221_getClockOut(mcp2221_t* device, mcp2221_clkdiv_t* div, mcp2221_clkduty_t* duty)
+{
+	NEW_REPORT(report);
+	mcp2221_error res;
+	res = getSRAM(device, report);
+	if(res == MCP2221_SUCCESS)
+	{
+		*div = report[5] & 0x07;
+		*duty = report[5] & 0x18;
+	}
 	return res;
 }
 
+mcp2221_error LIB_EXPORT mcp2221_setDAC(mcp2221_t* device, mcp2221_dac_ref_t ref, int value)
+{
+	mcp2221_sramupdate_t update = mcp2221_SRAMUpdateInit();
+	mcp2221_SRAMUpdateDAC(&update, ref, value);
+	return mcp2221_SRAMUpdateSend(device, &update);
+}
+
 mcp2221_error LIB_EXPORT mcp2221_getDAC(mcp2221_t* device, mcp2221_dac_ref_t* ref, int* value)
 {
 	NEW_REPORT(report);
 	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_GETSRAM)) != MCP2221_SUCCESS)
-		return res;
-	res = doTransaction(device, report);
+	res = getSRAM(device, report);
 	if(res == MCP2221_SUCCESS)
 	{
 		uint8_t temp = report[6]>>5;
@@ -651,22 +1556,16 @@ mcp2221_error LIB_EXPORT mcp2221_getDAC(mcp2221_t* device, mcp2221_dac_ref_t* re
 
 mcp2221_error LIB_EXPORT mcp2221_setADC(mcp2221_t* device, mcp2221_adc_ref_t ref)
 {
-	NEW_REPORT(report);
-	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_SETSRAM)) != MCP2221_SUCCESS)
-		return res;
-	report[5] = 0x80 | ref;
-	res = doTransaction(device, report);
-	return res;
+	mcp2221_sramupdate_t update = mcp2221_SRAMUpdateInit();
+	mcp2221_SRAMUpdateADC(&update, ref);
+	return mcp2221_SRAMUpdateSend(device, &update);
 }
 
 mcp2221_error LIB_EXPORT mcp2221_getADC(mcp2221_t* device, mcp2221_adc_ref_t* ref)
 {
 	NEW_REPORT(report);
 	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_GETSRAM)) != MCP2221_SUCCESS)
-		return res;
-	res = doTransaction(device, report);
+	res = getSRAM(device, report);
 	if(res == MCP2221_SUCCESS)
 		*ref = (report[7]>>2) & 7;
 	return res;
@@ -689,24 +1588,16 @@ mcp2221_error LIB_EXPORT mcp2221_readADC(mcp2221_t* device, int values[MCP2221_A
 
 mcp2221_error LIB_EXPORT mcp2221_setInterrupt(mcp2221_t* device, mcp2221_int_trig_t trig, int clearInt)
 {
-	NEW_REPORT(report);
-	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_SETSRAM)) != MCP2221_SUCCESS)
-		return res;
-	report[6] = 0x80 | 0x04 | 0x10 | trig;
-	if(clearInt)
-		report[6] |= 1;
-	res = doTransaction(device, report);
-	return res;
+	mcp2221_sramupdate_t update = mcp2221_SRAMUpdateInit();
+	mcp2221_SRAMUpdateInterrupt(&update, trig, clearInt);
+	return mcp2221_SRAMUpdateSend(device, &update);
 }
 
 mcp2221_error LIB_EXPORT mcp2221_getInterrupt(mcp2221_t* device, mcp2221_int_trig_t* trig)
 {
 	NEW_REPORT(report);
 	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_GETSRAM)) != MCP2221_SUCCESS)
-		return res;
-	res = doTransaction(device, report);
+	res = getSRAM(device, report);
 	if(res == MCP2221_SUCCESS)
 		*trig = (report[7]>>5);
 	return res;
@@ -725,6 +1616,32 @@ mcp2221_error LIB_EXPORT mcp2221_readInterrupt(mcp2221_t* device, int* state)
 	return res;
 }
 
+mcp2221_error LIB_EXPORT mcp2221_readStatus(mcp2221_t* device, mcp2221_status_t* status)
+{
+	if(!status)
+		return MCP2221_INVALID_ARG;
+
+	NEW_REPORT(report);
+	mcp2221_error res;
+	if((res = setReport(device, report, USB_CMD_STATUSSET)) != MCP2221_SUCCESS)
+		return res;
+	res = doTransaction(device, report);
+	if(res == MCP2221_SUCCESS)
+	{
+		for(int i=0;i<MCP2221_ADC_COUNT;i++)
+			status->adc[i] = (report[51 + (i * 2)]<<8) | report[50 + (i * 2)];
+		status->interrupt = report[24];
+		status->i2cState = report[8];
+		status->i2cPins.SCL = report[22];
+		status->i2cPins.SDA = report[23];
+		status->hardware[0] = report[46];
+		status->hardware[1] = report[47];
+		status->firmware[0] = report[48];
+		status->firmware[1] = report[49];
+	}
+	return res;
+}
+
 mcp2221_error LIB_EXPORT mcp2221_clearInterrupt(mcp2221_t* device)
 {
 	NEW_REPORT(report);
@@ -732,7 +1649,7 @@ mcp2221_error LIB_EXPORT mcp2221_clearInterrupt(mcp2221_t* device)
 	if((res = setReport(device, report, USB_CMD_SETSRAM)) != MCP2221_SUCCESS)
 		return res;
 	report[6] = 0x81;
-	res = doTransaction(device, report);
+	res = setSRAM(device, report);
 	return res;
 }
 
@@ -751,69 +1668,53 @@ mcp2221_gpioconfset_t LIB_EXPORT mcp2221_GPIOConfInit()
 
 mcp2221_error LIB_EXPORT mcp2221_setGPIOConf(mcp2221_t* device, mcp2221_gpioconfset_t* confSet)
 {
-	NEW_REPORT(report);
+	mcp2221_sramupdate_t update = mcp2221_SRAMUpdateInit();
 	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_SETSRAM)) != MCP2221_SUCCESS)
+	if((res = mcp2221_SRAMUpdateGPIOConf(device, &update, confSet)) != MCP2221_SUCCESS)
 		return res;
-
-	report[7] = 0x80; // datasheet says this should be 1, but should actually be 0x80
-
-	// Load current GPIO settings
-	// When writing GPIO stuff to SRAM all GPIOs must be reconfigured, even if we only want to change one
-	// Instead of reading from the device we store GPIO settings locally to speed things up a bit
-	for(int i=0;i<MCP2221_GPIO_COUNT;i++)
-		report[8 + i] = device->gpioCache[i];
-
-	for(int i=0;i<MCP2221_GPIO_COUNT;i++)
-	{
-		uint8_t val = 0;
-
-		if(confSet->conf[i].value == MCP2221_GPIO_VALUE_HIGH)
-			val |= 16;
-
-		if(confSet->conf[i].direction == MCP2221_GPIO_DIR_INPUT)
-			val |= 8;
-
-		val |= confSet->conf[i].mode;
-
-		if(confSet->conf[i].gpios & MCP2221_GPIO0)
-			report[8] = val;
-
-		if(confSet->conf[i].gpios & MCP2221_GPIO1)
-			report[9] = val;
-
-		if(confSet->conf[i].gpios & MCP2221_GPIO2)
-			report[10] = val;
-
-		if(confSet->conf[i].gpios & MCP2221_GPIO3)
-			report[11] = val;
-	}
-
-	// Save to cache
-	for(int i=0;i<MCP2221_GPIO_COUNT;i++)
-		device->gpioCache[i] = report[8 + i];
-
-	res = doTransaction(device, report);
-	return res;
+	return mcp2221_SRAMUpdateSend(device, &update);
 }
 
 mcp2221_error LIB_EXPORT mcp2221_setGPIO(mcp2221_t* device, mcp2221_gpio_t pins, mcp2221_gpio_value_t value)
+{
+	return mcp2221_setGPIOValues(device, pins, (value == MCP2221_GPIO_VALUE_HIGH) ? pins : 0);
+}
+
+mcp2221_error LIB_EXPORT mcp2221_setGPIOValues(mcp2221_t* device, int pins, int values)
 {
 	NEW_REPORT(report);
 	mcp2221_error res;
 	if((res = setReport(device, report, USB_CMD_SETGPIO)) != MCP2221_SUCCESS)
 		return res;
 
+	// Pins are already set to these values
+	if(device->priv->suppressWrites && device->priv->sramValid)
+	{
+		int changed = 0;
+		for(int i=0;i<MCP2221_GPIO_COUNT;i++)
+		{
+			if((pins & (1 << i)) && !!(device->gpioCache[i] & 16) != !!(values & (1 << i)))
+				changed = 1;
+		}
+
+		if(!changed)
+		{
+			device->priv->stats.suppressedWrites++;
+			return MCP2221_SUCCESS;
+		}
+	}
+
+	// Each pin has its own alter and value bytes
 	for(int i=0;i<MCP2221_GPIO_COUNT;i++)
 	{
 		if(pins & (1 << i))
 		{
 			int idx = (i * 4) + 2;
 			report[idx] = 1;
-			report[idx + 1] = value;
+			report[idx + 1] = (values & (1 << i)) ? MCP2221_GPIO_VALUE_HIGH : MCP2221_GPIO_VALUE_LOW;
 
 			// Save to cache for use in mcp2221_setGPIOConf()
-			if(value == MCP2221_GPIO_VALUE_HIGH)
+			if(values & (1 << i))
 				device->gpioCache[i] |= 16;
 			else
 				device->gpioCache[i] &= ~16;
@@ -821,6 +1722,13 @@ mcp2221_error LIB_EXPORT mcp2221_setGPIO(mcp2221_t* device, mcp2221_gpio_t pins,
 	}
 
 	res = doTransaction(device, report);
+	if(res == MCP2221_SUCCESS)
+	{
+		memcpy(&device->priv->sram[22], device->gpioCache, MCP2221_GPIO_COUNT);
+		device->priv->sramGeneration++;
+	}
+	else
+		device->priv->sramValid = 0;
 	return res;
 }
 
@@ -828,9 +1736,7 @@ mcp2221_error LIB_EXPORT mcp2221_getGPIO(mcp2221_t* device, mcp2221_gpioconfset_
 {
 	NEW_REPORT(report);
 	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_GETSRAM)) != MCP2221_SUCCESS)
-		return res;
-	res = doTransaction(device, report);
+	res = getSRAM(device, report);
 
 	if(res == MCP2221_SUCCESS)
 	{
@@ -861,6 +1767,327 @@ mcp2221_error LIB_EXPORT mcp2221_readGPIO(mcp2221_t* device, mcp2221_gpio_value_
 	return res;
 }
 
+mcp2221_error LIB_EXPORT mcp2221_setFlashCache(mcp2221_t* device, int enable)
+{
+	if(!device)
+		return MCP2221_INVALID_ARG;
+	device->priv->flashCache = enable;
+	if(!enable && device->priv->flash && !((flash_image_t*)device->priv->flash)->session)
+		((flash_image_t*)device->priv->flash)->loaded = 0;
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_refreshFlash(mcp2221_t* device)
+{
+	if(!device)
+		return MCP2221_INVALID_ARG;
+
+	flash_image_t* image = getFlashImage(device);
+	if(!image)
+		return MCP2221_ERROR;
+
+	// Don't throw away changes waiting for mcp2221_flashCommit()
+	image->loaded &= image->dirty;
+	return loadFlashImage(device, image);
+}
+
+void LIB_EXPORT mcp2221_invalidateFlash(mcp2221_t* device)
+{
+	if(device && device->priv->flash)
+	{
+		flash_image_t* image = device->priv->flash;
+		image->loaded &= image->dirty;
+	}
+}
+
+mcp2221_error LIB_EXPORT mcp2221_flashBegin(mcp2221_t* device)
+{
+	if(!device)
+		return MCP2221_INVALID_ARG;
+
+	flash_image_t* image = getFlashImage(device);
+	if(!image)
+		return MCP2221_ERROR;
+	if(image->session)
+		return MCP2221_ERROR;
+
+	// Without the cache each session starts with fresh reads
+	if(!device->priv->flashCache)
+		image->loaded = 0;
+	image->dirty = 0;
+	image->session = 1;
+
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_flashCommit(mcp2221_t* device)
+{
+	if(!device)
+		return MCP2221_INVALID_ARG;
+
+	flash_image_t* image = device->priv->flash;
+	if(!image || !image->session)
+		return MCP2221_ERROR;
+
+	// Chip settings last, they might turn on password protection which would stop the other writes
+	for(int n=1;n<=FLASH_SECTION_COUNT;n++)
+	{
+		int i = n % FLASH_SECTION_COUNT;
+		if(!(image->dirty & (1<<i)))
+			continue;
+
+		NEW_REPORT(report);
+		mcp2221_error res;
+		if((res = setReport(device, report, USB_CMD_WRITEFLASH)) != MCP2221_SUCCESS)
+			return res;
+
+		int offset = flashDataOffset(i);
+		report[1] = i;
+		memcpy(&report[2], &image->data[i][2 + offset], REPORT_SIZE - 2 - offset);
+
+		// Leave the session open if something goes wrong so the rest can be tried again
+		if((res = sendFlashWrite(device, report)) != MCP2221_SUCCESS)
+			return res;
+
+		image->dirty &= ~(1<<i);
+	}
+
+	image->session = 0;
+
+	return MCP2221_SUCCESS;
+}
+
+void LIB_EXPORT mcp2221_flashCancel(mcp2221_t* device)
+{
+	if(device && device->priv->flash)
+	{
+		// Sections with changes that weren't written no longer match the device
+		flash_image_t* image = device->priv->flash;
+		image->loaded &= ~image->dirty;
+		image->dirty = 0;
+		image->session = 0;
+	}
+}
+
+// Snapshot layout:
+// 0 - 3: Magic "M221"
+// 4: Format version
+// 5: Number of 64 byte blocks that follow
+// 6 - 7: Reserved (0)
+// Then a GETSRAM response followed by a READFLASH response for each flash section, in flash_section_t order
+#define SNAPSHOT_MAGIC		"M221"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_HEADER		8
+#define SNAPSHOT_BLOCKS		(1 + FLASH_SECTION_COUNT)
+
+static const uint8_t* snapshotBlock(const mcp2221_snapshot_t* snapshot, int block)
+{
+	return &snapshot->data[SNAPSHOT_HEADER + (block * REPORT_SIZE)];
+}
+
+static int snapshotValid(const mcp2221_snapshot_t* snapshot)
+{
+	return snapshot &&
+		memcmp(snapshot->data, SNAPSHOT_MAGIC, 4) == 0 &&
+		snapshot->data[4] == SNAPSHOT_VERSION &&
+		snapshot->data[5] == SNAPSHOT_BLOCKS;
+}
+
+// Only compare the bytes that mean something, the rest of the responses can be anything
+static int snapshotSectionDiffers(const uint8_t* a, const uint8_t* b, int section)
+{
+	switch(section)
+	{
+		case FLASH_SECTION_CHIPSETTINGS:
+			return memcmp(&a[4], &b[4], 10) != 0;
+		case FLASH_SECTION_GPIOSETTINGS:
+			return memcmp(&a[4], &b[4], MCP2221_GPIO_COUNT) != 0;
+		default: // Descriptors and factory serial, [2] is the length + 2
+		{
+			if(a[2] != b[2])
+				return 1;
+			int len = a[2] - 2;
+			if(len < 0)
+				len = 0;
+			else if(len > REPORT_SIZE - 4)
+				len = REPORT_SIZE - 4;
+			return memcmp(&a[4], &b[4], len) != 0;
+		}
+	}
+}
+
+mcp2221_error LIB_EXPORT mcp2221_snapshotTake(mcp2221_t* device, mcp2221_snapshot_t* snapshot)
+{
+	if(!device || !snapshot)
+		return MCP2221_INVALID_ARG;
+
+	// GETSRAM and a READFLASH for every section, all in one go
+	mcp2221_report_t reports[SNAPSHOT_BLOCKS];
+	setReport(device, reports[0].data, USB_CMD_GETSRAM);
+	for(int i=0;i<FLASH_SECTION_COUNT;i++)
+	{
+		setReport(device, reports[1 + i].data, USB_CMD_READFLASH);
+		reports[1 + i].data[1] = i;
+	}
+
+	mcp2221_error res;
+	if((res = doPipeline(device, reports, SNAPSHOT_BLOCKS, device->priv->timeout)) != MCP2221_SUCCESS)
+		return res;
+
+	storeSRAM(device, reports[0].data);
+
+	// Might as well fill the flash cache too, as long as there are no uncommitted changes
+	flash_image_t* image = device->priv->flash;
+	if(image && device->priv->flashCache && !image->session)
+	{
+		for(int i=0;i<FLASH_SECTION_COUNT;i++)
+			memcpy(image->data[i], reports[1 + i].data, REPORT_SIZE);
+		image->loaded = FLASH_ALL_SECTIONS;
+	}
+
+	memset(snapshot, 0x00, sizeof(mcp2221_snapshot_t));
+	memcpy(snapshot->data, SNAPSHOT_MAGIC, 4);
+	snapshot->data[4] = SNAPSHOT_VERSION;
+	snapshot->data[5] = SNAPSHOT_BLOCKS;
+	for(int i=0;i<SNAPSHOT_BLOCKS;i++)
+		memcpy(&snapshot->data[SNAPSHOT_HEADER + (i * REPORT_SIZE)], reports[i].data, REPORT_SIZE);
+
+	return MCP2221_SUCCESS;
+}
+
+int LIB_EXPORT mcp2221_snapshotDiff(const mcp2221_snapshot_t* snapshot1, const mcp2221_snapshot_t* snapshot2)
+{
+	if(!snapshotValid(snapshot1) || !snapshotValid(snapshot2))
+		return MCP2221_INVALID_ARG;
+
+	int parts = 0;
+
+	// SRAM settings that SETSRAM can change: clock, DAC, ADC/interrupt and GPIO
+	const uint8_t* sram1 = snapshotBlock(snapshot1, 0);
+	const uint8_t* sram2 = snapshotBlock(snapshot2, 0);
+	if(memcmp(&sram1[5], &sram2[5], 3) != 0 || memcmp(&sram1[22], &sram2[22], MCP2221_GPIO_COUNT) != 0)
+		parts |= MCP2221_SNAPSHOT_SRAM;
+
+	for(int i=0;i<FLASH_SECTION_COUNT;i++)
+	{
+		if(snapshotSectionDiffers(snapshotBlock(snapshot1, 1 + i), snapshotBlock(snapshot2, 1 + i), i))
+			parts |= 1<<i;
+	}
+
+	return parts;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_snapshotApply(mcp2221_t* device, const mcp2221_snapshot_t* snapshot, int parts)
+{
+	if(!device || !snapshotValid(snapshot))
+		return MCP2221_INVALID_ARG;
+
+	// Chip settings with password protection on would also write our copy of the password, which the snapshot doesn't have
+	// Without one from mcp2221_unlockFlash() or mcp2221_savePassword() the device would end up with a password of all zeros
+	if(parts & MCP2221_SNAPSHOT_CHIPSETTINGS)
+	{
+		const uint8_t* chip = snapshotBlock(snapshot, 1 + FLASH_SECTION_CHIPSETTINGS);
+		if((chip[4] & 0x03) == MCP2221_SECURITY_PASSWORD && !device->priv->flashPasswordSet)
+			return MCP2221_INVALID_ARG;
+	}
+
+	mcp2221_error res;
+
+	// Flash sections go through flashWrite() so they join the flash session if one is open
+	// The factory serial is read-only
+	for(int i=0;i<FLASH_SECTION_COUNT;i++)
+	{
+		if(!(parts & (1<<i)) || i == FLASH_SECTION_FACTORYSERIAL)
+			continue;
+
+		const uint8_t* data = snapshotBlock(snapshot, 1 + i);
+		NEW_REPORT(report);
+		if((res = setReport(device, report, USB_CMD_WRITEFLASH)) != MCP2221_SUCCESS)
+			return res;
+
+		int offset = flashDataOffset(i);
+		report[1] = i;
+		memcpy(&report[2], &data[2 + offset], REPORT_SIZE - 2 - offset);
+
+		if((res = flashWrite(device, report)) != MCP2221_SUCCESS)
+			return res;
+	}
+
+	if(parts & MCP2221_SNAPSHOT_SRAM)
+	{
+		// Turn the GETSRAM response back into a SETSRAM report that changes everything at once
+		const uint8_t* sram = snapshotBlock(snapshot, 0);
+		NEW_REPORT(report);
+		if((res = setReport(device, report, USB_CMD_SETSRAM)) != MCP2221_SUCCESS)
+			return res;
+
+		report[2] = 0x80 | (sram[5] & 0x1F);
+		report[3] = 0x80 | (sram[6]>>5);
+		report[4] = 0x80 | (sram[6] & 0x1F);
+		report[5] = 0x80 | ((sram[7]>>2) & 0x07);
+		report[6] = 0x80 | 0x10 | 0x04;
+		if(sram[7] & 0x20)
+			report[6] |= MCP2221_INT_TRIG_RISING;
+		if(sram[7] & 0x40)
+			report[6] |= MCP2221_INT_TRIG_FALLING;
+		report[7] = 0x80;
+		memcpy(&report[8], &sram[22], MCP2221_GPIO_COUNT);
+
+		if((res = setSRAM(device, report)) != MCP2221_SUCCESS)
+			return res;
+	}
+
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_unlockFlash(mcp2221_t* device, const uint8_t password[MCP2221_PASSWORD_LEN])
+{
+	if(!password)
+		return MCP2221_INVALID_ARG;
+
+	NEW_REPORT(report);
+	mcp2221_error res;
+	if((res = setReport(device, report, USB_CMD_FLASHPASS)) != MCP2221_SUCCESS)
+		return res;
+
+	// Already unlocked with this password, the device doesn't need telling again
+	if(device->priv->flashUnlocked && memcmp(device->priv->flashPassword, password, MCP2221_PASSWORD_LEN) == 0)
+		return MCP2221_SUCCESS;
+
+	memcpy(&report[2], password, MCP2221_PASSWORD_LEN);
+	res = doTransaction(device, report);
+	if(res == MCP2221_SUCCESS)
+	{
+		memcpy(device->priv->flashPassword, password, MCP2221_PASSWORD_LEN);
+		device->priv->flashUnlocked = 1;
+		device->priv->flashPasswordSet = 1;
+	}
+	else if(res == MCP2221_ERROR_STATUS)
+		res = MCP2221_ERROR_ACCESS;
+
+	return res;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_savePassword(mcp2221_t* device, const uint8_t password[MCP2221_PASSWORD_LEN])
+{
+	NEW_REPORT(report);
+	mcp2221_error res;
+	if((res = saveReport(device, report)) != MCP2221_SUCCESS)
+		return res;
+
+	// sendFlashWrite() puts the password into the report
+	if(password)
+		memcpy(device->priv->flashPassword, password, MCP2221_PASSWORD_LEN);
+	else
+		memset(device->priv->flashPassword, 0x00, MCP2221_PASSWORD_LEN);
+	device->priv->flashPasswordSet = (password != NULL);
+
+	NEW_REPORT(reportUpdate);
+	saveReportUpdate(report, reportUpdate);
+	reportUpdate[2] = (reportUpdate[2] & ~0x03) | (password ? MCP2221_SECURITY_PASSWORD : MCP2221_SECURITY_UNSECURED);
+	return flashWrite(device, reportUpdate);
+}
+
 mcp2221_error LIB_EXPORT mcp2221_saveManufacturer(mcp2221_t* device, wchar_t* buffer)
 {
 	return setDescriptor(device, buffer, FLASH_SECTION_USBMANUFACTURER);
@@ -906,7 +2133,7 @@ mcp2221_error LIB_EXPORT mcp2221_saveVIDPID(mcp2221_t* device, int vid, int pid)
 		reportUpdate[7] = vid>>8;
 		reportUpdate[8] = pid;
 		reportUpdate[9] = pid>>8;
-		res = doTransaction(device, reportUpdate);
+		res = flashWrite(device, reportUpdate);
 	}
 
 	return res;
@@ -927,7 +2154,7 @@ mcp2221_error LIB_EXPORT mcp2221_saveSerialEnumerate(mcp2221_t* device, int enum
 		NEW_REPORT(reportUpdate);
 		saveReportUpdate(report, reportUpdate);
 		reportUpdate[2] = val;
-		res = doTransaction(device, reportUpdate);
+		res = flashWrite(device, reportUpdate);
 	}
 
 	return res;
@@ -952,7 +2179,7 @@ mcp2221_error LIB_EXPORT mcp2221_saveMilliamps(mcp2221_t* device, int milliamps)
 		NEW_REPORT(reportUpdate);
 		saveReportUpdate(report, reportUpdate);
 		reportUpdate[11] = milliamps;
-		res = doTransaction(device, reportUpdate);
+		res = flashWrite(device, reportUpdate);
 	}
 
 	return res;
@@ -972,7 +2199,7 @@ mcp2221_error LIB_EXPORT mcp2221_savePowerSource(mcp2221_t* device, mcp2221_pwrs
 		NEW_REPORT(reportUpdate);
 		saveReportUpdate(report, reportUpdate);
 		reportUpdate[10] = val; // REG IS SHARED WITH BOTH POWER SOURCE AND REMOTE WAKEUP
-		res = doTransaction(device, reportUpdate);
+		res = flashWrite(device, reportUpdate);
 	}
 
 	return res;
@@ -992,7 +2219,7 @@ mcp2221_error LIB_EXPORT mcp2221_saveRemoteWakeup(mcp2221_t* device, mcp2221_wak
 		NEW_REPORT(reportUpdate);
 		saveReportUpdate(report, reportUpdate);
 		reportUpdate[10] = val; // REG IS SHARED WITH BOTH POWER SOURCE AND REMOTE WAKEUP
-		res = doTransaction(device, reportUpdate);
+		res = flashWrite(device, reportUpdate);
 	}
 
 	return res;
@@ -1013,7 +2240,7 @@ mcp2221_error LIB_EXPORT mcp2221_savePolarity(mcp2221_t* device, mcp2221_dedipin
 		NEW_REPORT(reportUpdate);
 		saveReportUpdate(report, reportUpdate);
 		reportUpdate[2] = val;
-		res = doTransaction(device, reportUpdate);
+		res = flashWrite(device, reportUpdate);
 	}
 
 	return res;
@@ -1031,7 +2258,7 @@ mcp2221_error LIB_EXPORT mcp2221_saveClockOut(mcp2221_t* device, mcp2221_clkdiv_
 		NEW_REPORT(reportUpdate);
 		saveReportUpdate(report, reportUpdate);
 		reportUpdate[3] = clkdiv | duty;
-		res = doTransaction(device, reportUpdate);
+		res = flashWrite(device, reportUpdate);
 	}
 
 	return res;
@@ -1056,7 +2283,7 @@ mcp2221_error LIB_EXPORT mcp2221_saveDAC(mcp2221_t* device, mcp2221_dac_ref_t re
 		NEW_REPORT(reportUpdate);
 		saveReportUpdate(report, reportUpdate);
 		reportUpdate[4] = ref | value;
-		res = doTransaction(device, reportUpdate);
+		res = flashWrite(device, reportUpdate);
 	}
 	
 	return res;
@@ -1076,7 +2303,7 @@ mcp2221_error LIB_EXPORT mcp2221_saveADC(mcp2221_t* device, mcp2221_adc_ref_t re
 		NEW_REPORT(reportUpdate);
 		saveReportUpdate(report, reportUpdate);
 		reportUpdate[5] = (reportUpdate[5] & 0x60) | ref; // this is shared with both ADC and interrupt stuff!
-		res = doTransaction(device, reportUpdate);
+		res = flashWrite(device, reportUpdate);
 	}
 	
 	return res;
@@ -1110,7 +2337,7 @@ mcp2221_error LIB_EXPORT mcp2221_saveInterrupt(mcp2221_t* device, mcp2221_int_tr
 		NEW_REPORT(reportUpdate);
 		saveReportUpdate(report, reportUpdate);
 		reportUpdate[5] = (reportUpdate[5] & 0x9F) | trigVal; // this is shared with both ADC and interrupt stuff!
-		res = doTransaction(device, reportUpdate);
+		res = flashWrite(device, reportUpdate);
 	}
 	
 	return res;
@@ -1120,11 +2347,7 @@ mcp2221_error LIB_EXPORT mcp2221_saveGPIOConf(mcp2221_t* device, mcp2221_gpiocon
 {
 	NEW_REPORT(report);
 	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_READFLASH)) != MCP2221_SUCCESS)
-		return res;
-	report[1] = FLASH_SECTION_GPIOSETTINGS;
-	res = doTransaction(device, report);
-	if(res != MCP2221_SUCCESS)
+	if((res = flashRead(device, FLASH_SECTION_GPIOSETTINGS, report)) != MCP2221_SUCCESS)
 		return res;
 
 	NEW_REPORT(reportUpdate);
@@ -1135,15 +2358,7 @@ mcp2221_error LIB_EXPORT mcp2221_saveGPIOConf(mcp2221_t* device, mcp2221_gpiocon
 
 	for(int i=0;i<MCP2221_GPIO_COUNT;i++)
 	{
-		uint8_t val = 0;
-
-		if(confSet->conf[i].value == MCP2221_GPIO_VALUE_HIGH)
-			val |= 16;
-
-		if(confSet->conf[i].direction == MCP2221_GPIO_DIR_INPUT)
-			val |= 8;
-
-		val |= confSet->conf[i].mode;
+		uint8_t val = gpioConfValue(&confSet->conf[i]);
 
 		if(confSet->conf[i].gpios & MCP2221_GPIO0)
 			reportUpdate[2] = val;
@@ -1159,24 +2374,24 @@ mcp2221_error LIB_EXPORT mcp2221_saveGPIOConf(mcp2221_t* device, mcp2221_gpiocon
 	}
 
 	if(memcmp(&report[4], &reportUpdate[2], 4) != 0) // Only update if something is different
-		res = doTransaction(device, reportUpdate);
+		res = flashWrite(device, reportUpdate);
 
 	return res;
 }
 
 mcp2221_error LIB_EXPORT mcp2221_loadManufacturer(mcp2221_t* device, wchar_t* buffer)
 {
-	return getDescriptor2(device, buffer, FLASH_SECTION_USBMANUFACTURER);
+	return getDescriptor(device, buffer, FLASH_SECTION_USBMANUFACTURER);
 }
 
 mcp2221_error LIB_EXPORT mcp2221_loadProduct(mcp2221_t* device, wchar_t* buffer)
 {
-	return getDescriptor2(device, buffer, FLASH_SECTION_USBPRODUCT);
+	return getDescriptor(device, buffer, FLASH_SECTION_USBPRODUCT);
 }
 
 mcp2221_error LIB_EXPORT mcp2221_loadSerial(mcp2221_t* device, wchar_t* buffer)
 {
-	return getDescriptor2(device, buffer, FLASH_SECTION_USBSERIAL);
+	return getDescriptor(device, buffer, FLASH_SECTION_USBSERIAL);
 }
 
 mcp2221_error mcp2221_loadVIDPID(mcp2221_t* device, int* vid, int* pid)
@@ -1190,6 +2405,16 @@ mcp2221_error mcp2221_loadVIDPID(mcp2221_t* device, int* vid, int* pid)
 	return res;
 }
 
+mcp2221_error LIB_EXPORT mcp2221_loadSecurity(mcp2221_t* device, mcp2221_security_t* security)
+{
+	NEW_REPORT(report);
+	mcp2221_error res;
+	if((res = saveReport(device, report)) != MCP2221_SUCCESS)
+		return res;
+	*security = (report[4] & 0x03) ? ((report[4] & 0x02) ? MCP2221_SECURITY_LOCKED : MCP2221_SECURITY_PASSWORD) : MCP2221_SECURITY_UNSECURED;
+	return res;
+}
+
 mcp2221_error LIB_EXPORT mcp2221_loadSerialEnumerate(mcp2221_t* device, int* enumerate)
 {
 	NEW_REPORT(report);
@@ -1296,10 +2521,7 @@ mcp2221_error LIB_EXPORT mcp2221_loadGPIOConf(mcp2221_t* device, mcp2221_gpiocon
 {
 	NEW_REPORT(report);
 	mcp2221_error res;
-	if((res = setReport(device, report, USB_CMD_READFLASH)) != MCP2221_SUCCESS)
-		return res;
-	report[1] = FLASH_SECTION_GPIOSETTINGS;
-	res = doTransaction(device, report);
+	res = flashRead(device, FLASH_SECTION_GPIOSETTINGS, report);
 
 	if(res == MCP2221_SUCCESS)
 	{
@@ -0,0 +1,377 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Hot-plug monitor, keeps the registry up to date without having to call mcp2221_find() again
+// On Linux this listens to uevents on a netlink socket, the same ones libudev uses, so libudev isn't needed.
+// Events come from udevd once it has finished with the device (so permissions have been set up), or straight
+// from the kernel if udevd isn't running. Other OSes aren't supported yet.
+
+#ifdef __linux__
+	#define _GNU_SOURCE	// struct ucred
+	#include <stdio.h>
+	#include <errno.h>
+	#include <limits.h>
+	#include <unistd.h>
+	#include <poll.h>
+	#include <sys/socket.h>
+	#include <arpa/inet.h>
+	#include <linux/netlink.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "libmcp2221.h"
+#include "internal.h"
+
+#define MONITOR_GROUP_KERNEL	1
+#define MONITOR_GROUP_UDEV		2
+#define MONITOR_RCVBUF			(1024 * 1024)	// Lots of devices can be plugged in at once when a hub gets powered up
+#define MONITOR_MSG_SIZE		8192
+#define UDEV_MAGIC				0xfeedcafe
+#define SYSFS_HIDRAW			"/sys/class/hidraw"
+
+struct mcp2221_monitor_t{
+	mcp2221_ctx_t* ctx;
+	int vid;
+	int pid;
+	mcp2221_hotplug_t attached;
+	mcp2221_hotplug_t detached;
+	void* userData;
+#ifdef __linux__
+	int fd;
+	int fromUdev;	// Listening to udevd instead of the kernel
+	int resync;		// Events might have been missed, compare the registry against sysfs
+	int events;		// Callbacks fired during the current mcp2221_monitorRun()
+#endif
+};
+
+#ifdef __linux__
+
+// Header udevd puts in front of its messages (struct udev_monitor_netlink_header in libudev)
+typedef struct{
+	char prefix[8];				// "libudev"
+	uint32_t magic;				// UDEV_MAGIC, big endian
+	uint32_t headerSize;
+	uint32_t propertiesOff;
+	uint32_t propertiesLen;
+	uint32_t filterSubsystemHash;
+	uint32_t filterDevtypeHash;
+	uint32_t filterTagBloomHi;
+	uint32_t filterTagBloomLo;
+}udev_header_t;
+
+// Same thing libudev checks to see if udevd is running
+static int udevRunning(void)
+{
+	return access("/run/udev/control", F_OK) == 0;
+}
+
+static void monitorAttached(void* userData, const char* path, const wchar_t* manufacturer, const wchar_t* product, const wchar_t* serial)
+{
+	UNUSED(manufacturer);
+	UNUSED(product);
+
+	mcp2221_monitor_t* monitor = userData;
+	registry_t* registry = monitor->ctx->registry;
+	if(registryFindPath(registry, path) >= 0)
+		return;
+
+	int idx = registryAdd(registry, path, serial);
+	if(idx < 0)
+		return;
+
+	monitor->events++;
+	if(monitor->attached)
+		monitor->attached(idx, path, monitor->userData);
+}
+
+static void monitorDetached(mcp2221_monitor_t* monitor, const char* path)
+{
+	int idx = registryRemove(monitor->ctx->registry, path);
+	if(idx < 0)
+		return;
+
+	monitor->events++;
+	if(monitor->detached)
+		monitor->detached(idx, path, monitor->userData);
+}
+
+// Catch up after events were missed (or before the first run, in case something changed after mcp2221_find())
+// Devices that have gone from sysfs are detached and anything new is attached
+static void monitorResync(mcp2221_monitor_t* monitor)
+{
+	registry_t* registry = monitor->ctx->registry;
+	int count = registryCount(registry);
+	for(int i=0;i<count;i++)
+	{
+		char* path = registryPath(registry, i);
+		if(!path)
+			continue;
+
+		// Only hidraw paths can be checked, HIDAPI's libusb backend uses bus and port numbers
+		if(strncmp(path, "/dev/hidraw", 11) == 0)
+		{
+			char sysPath[PATH_MAX];
+			snprintf(sysPath, sizeof(sysPath), SYSFS_HIDRAW "/%s", path + 5);
+			if(access(sysPath, F_OK) != 0)
+				monitorDetached(monitor, path);
+		}
+
+		free(path);
+	}
+
+	hidraw_enumerate(monitor->vid, monitor->pid, monitorAttached, monitor);
+}
+
+// Find a property in a list of null terminated KEY=VALUE strings
+static const char* getProperty(const char* props, size_t len, const char* key)
+{
+	size_t keyLen = strlen(key);
+	for(size_t i=0;i<len;i+=strlen(&props[i]) + 1)
+	{
+		if(strncmp(&props[i], key, keyLen) == 0 && props[i + keyLen] == '=')
+			return &props[i + keyLen + 1];
+	}
+	return NULL;
+}
+
+static void monitorMessage(mcp2221_monitor_t* monitor, char* buff, size_t len)
+{
+	const char* props;
+	size_t propsLen;
+
+	if(monitor->fromUdev)
+	{
+		udev_header_t header;
+		if(len < sizeof(udev_header_t))
+			return;
+		memcpy(&header, buff, sizeof(udev_header_t));
+		if(memcmp(header.prefix, "libudev", 8) != 0 || ntohl(header.magic) != UDEV_MAGIC)
+			return;
+		if(header.propertiesOff >= len || header.propertiesLen > len - header.propertiesOff)
+			return;
+		props = &buff[header.propertiesOff];
+		propsLen = header.propertiesLen;
+	}
+	else
+	{
+		// Kernel messages start with "action@devpath"
+		size_t first = strlen(buff) + 1;
+		if(first >= len)
+			return;
+		props = &buff[first];
+		propsLen = len - first;
+	}
+
+	const char* subsystem = getProperty(props, propsLen, "SUBSYSTEM");
+	const char* action = getProperty(props, propsLen, "ACTION");
+	const char* devName = getProperty(props, propsLen, "DEVNAME");
+	if(!subsystem || !action || !devName || strcmp(subsystem, "hidraw") != 0)
+		return;
+
+	// udevd gives the full /dev path, the kernel just gives the name
+	const char* name = strrchr(devName, '/');
+	name = name ? name + 1 : devName;
+	if(strncmp(name, "hidraw", 6) != 0)
+		return;
+
+	if(strcmp(action, "add") == 0)
+		hidraw_probe(name, monitor->vid, monitor->pid, monitorAttached, monitor);
+	else if(strcmp(action, "remove") == 0)
+	{
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "/dev/%s", name);
+		monitorDetached(monitor, path);
+	}
+}
+
+// Read and handle everything waiting on the socket
+static mcp2221_error monitorReceive(mcp2221_monitor_t* monitor)
+{
+	// +1 so the message can always be null terminated
+	char buff[MONITOR_MSG_SIZE + 1];
+	char control[CMSG_SPACE(sizeof(struct ucred))];
+
+	while(1)
+	{
+		struct sockaddr_nl addr;
+		struct iovec iov = {
+			.iov_base = buff,
+			.iov_len = MONITOR_MSG_SIZE
+		};
+		struct msghdr msg = {
+			.msg_name = &addr,
+			.msg_namelen = sizeof(addr),
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = control,
+			.msg_controllen = sizeof(control)
+		};
+
+		ssize_t len = recvmsg(monitor->fd, &msg, 0);
+		if(len < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			else if(errno == EAGAIN || errno == EWOULDBLOCK)
+				return MCP2221_SUCCESS;
+			else if(errno == ENOBUFS)
+			{
+				// The socket buffer overflowed and some events were lost
+				monitor->resync = 1;
+				continue;
+			}
+			return MCP2221_ERROR;
+		}
+
+		if(msg.msg_flags & MSG_TRUNC)
+			continue;
+
+		// Anyone can send to the udev group, only believe messages from root
+		// Kernel messages have a port ID of 0
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		if(!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_CREDENTIALS)
+			continue;
+		struct ucred cred;
+		memcpy(&cred, CMSG_DATA(cmsg), sizeof(struct ucred));
+		if(cred.uid != 0)
+			continue;
+		if(!monitor->fromUdev && addr.nl_pid != 0)
+			continue;
+
+		buff[len] = '\0';
+		monitorMessage(monitor, buff, len);
+	}
+}
+
+#endif
+
+mcp2221_monitor_t* LIB_EXPORT mcp2221_ctxMonitorCreate(mcp2221_ctx_t* ctx, int vid, int pid, mcp2221_hotplug_t attached, mcp2221_hotplug_t detached, void* userData)
+{
+#ifdef __linux__
+	if(!ctx)
+		return NULL;
+
+	mcp2221_monitor_t* monitor = calloc(1, sizeof(mcp2221_monitor_t));
+	if(!monitor)
+		return NULL;
+
+	monitor->ctx = ctx;
+	monitor->vid = vid;
+	monitor->pid = pid;
+	monitor->attached = attached;
+	monitor->detached = detached;
+	monitor->userData = userData;
+	monitor->fromUdev = udevRunning();
+	monitor->resync = 1;
+
+	monitor->fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+	if(monitor->fd < 0)
+	{
+		free(monitor);
+		return NULL;
+	}
+
+	struct sockaddr_nl addr;
+	memset(&addr, 0x00, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = monitor->fromUdev ? MONITOR_GROUP_UDEV : MONITOR_GROUP_KERNEL;
+
+	int on = 1;
+	int rcvbuf = MONITOR_RCVBUF;
+	if(
+		bind(monitor->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+		setsockopt(monitor->fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)) < 0
+	)
+	{
+		close(monitor->fd);
+		free(monitor);
+		return NULL;
+	}
+
+	// Not a problem if this fails, a smaller buffer just means a resync is more likely
+	setsockopt(monitor->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	return monitor;
+#else
+	UNUSED(ctx);
+	UNUSED(vid);
+	UNUSED(pid);
+	UNUSED(attached);
+	UNUSED(detached);
+	UNUSED(userData);
+	return NULL;
+#endif
+}
+
+mcp2221_monitor_t* LIB_EXPORT mcp2221_monitorCreate(int vid, int pid, mcp2221_hotplug_t attached, mcp2221_hotplug_t detached, void* userData)
+{
+	return mcp2221_ctxMonitorCreate(getDefaultCtx(), vid, pid, attached, detached, userData);
+}
+
+void LIB_EXPORT mcp2221_monitorDestroy(mcp2221_monitor_t* monitor)
+{
+	if(!monitor)
+		return;
+#ifdef __linux__
+	close(monitor->fd);
+#endif
+	free(monitor);
+}
+
+int LIB_EXPORT mcp2221_monitorGetFd(mcp2221_monitor_t* monitor)
+{
+#ifdef __linux__
+	if(monitor)
+		return monitor->fd;
+#else
+	UNUSED(monitor);
+#endif
+	return -1;
+}
+
+int LIB_EXPORT mcp2221_monitorRun(mcp2221_monitor_t* monitor, int timeout)
+{
+	if(!monitor)
+		return MCP2221_INVALID_ARG;
+
+#ifdef __linux__
+	monitor->events = 0;
+
+	// Only wait if there's nothing to catch up on
+	if(!monitor->resync && timeout != 0)
+	{
+		struct pollfd pfd = {
+			.fd = monitor->fd,
+			.events = POLLIN
+		};
+
+		int res;
+		while((res = poll(&pfd, 1, timeout)) < 0 && errno == EINTR);
+		if(res < 0)
+			return MCP2221_ERROR;
+	}
+
+	mcp2221_error res = monitorReceive(monitor);
+
+	// Done after draining the socket so events that happened during the resync are still seen next time,
+	// any that are already covered by the resync are ignored since the registry is already up to date
+	if(monitor->resync)
+	{
+		monitor->resync = 0;
+		monitorResync(monitor);
+	}
+
+	if(res != MCP2221_SUCCESS)
+		return res;
+	return monitor->events;
+#else
+	UNUSED(timeout);
+	return MCP2221_ERROR;
+#endif
+}
@@ -0,0 +1,58 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Bulk open, opens every device found by mcp2221_find() at once
+
+#include <stdlib.h>
+#include "libmcp2221.h"
+#include "internal.h"
+#include "thread.h"
+
+typedef struct{
+	mcp2221_ctx_t* ctx;
+	mcp2221_t** devices;
+	mcp2221_error* results;
+}openall_t;
+
+static void openWorker(void* arg, int idx)
+{
+	openall_t* openAll = arg;
+
+	mcp2221_error res = MCP2221_SUCCESS;
+	openAll->devices[idx] = openIndex(openAll->ctx, idx, &res);
+	if(openAll->results)
+		openAll->results[idx] = res;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_ctxOpenAll(mcp2221_ctx_t* ctx, mcp2221_t** devices, mcp2221_error* results, int count)
+{
+	if(!ctx || !devices || count < 0)
+		return MCP2221_INVALID_ARG;
+
+	openall_t openAll;
+	openAll.ctx = ctx;
+	openAll.devices = devices;
+	openAll.results = results;
+
+	// Opening is a handful of round trips to the device, so like mcp2221_provisionAll() the time is spent waiting on USB
+	// and a thread for each device (up to a limit) means the total time is about the same as opening the slowest one
+	threadPool(count, openWorker, &openAll);
+
+	for(int i=0;i<count;i++)
+	{
+		if(!devices[i])
+			return MCP2221_ERROR;
+	}
+
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_openAll(mcp2221_t** devices, mcp2221_error* results, int count)
+{
+	return mcp2221_ctxOpenAll(getDefaultCtx(), devices, results, count);
+}
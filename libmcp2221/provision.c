@@ -0,0 +1,221 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Provisioning, applies a profile of flash settings to lots of devices at once
+
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "libmcp2221.h"
+#include "internal.h"
+#include "thread.h"
+
+typedef struct{
+	mcp2221_ctx_t* ctx;
+	const mcp2221_profile_t* profile;
+	mcp2221_provision_result_t* results;
+}provision_t;
+
+// What the flash will hold for a milliamps value after rounding and limiting, same as mcp2221_saveMilliamps()
+static int normaliseMilliamps(int milliamps)
+{
+	if(milliamps < 2)
+		milliamps = 2;
+	else if(milliamps > 500)
+		milliamps = 500;
+	return (milliamps / 2) * 2;
+}
+
+// Go through each field in the profile and count how many are different from the device
+// If apply is set then the different ones are saved
+static int diffProfile(mcp2221_t* device, const mcp2221_profile_t* profile, int apply, mcp2221_error* res)
+{
+	int changed = 0;
+	*res = MCP2221_SUCCESS;
+
+	if(profile->fields & MCP2221_PROFILE_MANUFACTURER)
+	{
+		wchar_t current[MCP2221_STR_LEN];
+		if((*res = mcp2221_loadManufacturer(device, current)) != MCP2221_SUCCESS)
+			return changed;
+		if(wcsncmp(current, profile->manufacturer, MCP2221_STR_LEN - 1) != 0)
+		{
+			changed++;
+			if(apply && (*res = mcp2221_saveManufacturer(device, (wchar_t*)profile->manufacturer)) != MCP2221_SUCCESS)
+				return changed;
+		}
+	}
+
+	if(profile->fields & MCP2221_PROFILE_PRODUCT)
+	{
+		wchar_t current[MCP2221_STR_LEN];
+		if((*res = mcp2221_loadProduct(device, current)) != MCP2221_SUCCESS)
+			return changed;
+		if(wcsncmp(current, profile->product, MCP2221_STR_LEN - 1) != 0)
+		{
+			changed++;
+			if(apply && (*res = mcp2221_saveProduct(device, (wchar_t*)profile->product)) != MCP2221_SUCCESS)
+				return changed;
+		}
+	}
+
+	if(profile->fields & MCP2221_PROFILE_VIDPID)
+	{
+		int vid, pid;
+		if((*res = mcp2221_loadVIDPID(device, &vid, &pid)) != MCP2221_SUCCESS)
+			return changed;
+		if(vid != profile->vid || pid != profile->pid)
+		{
+			changed++;
+			if(apply && (*res = mcp2221_saveVIDPID(device, profile->vid, profile->pid)) != MCP2221_SUCCESS)
+				return changed;
+		}
+	}
+
+	if(profile->fields & MCP2221_PROFILE_MILLIAMPS)
+	{
+		int milliamps;
+		if((*res = mcp2221_loadMilliamps(device, &milliamps)) != MCP2221_SUCCESS)
+			return changed;
+		if(milliamps != normaliseMilliamps(profile->milliamps))
+		{
+			changed++;
+			if(apply && (*res = mcp2221_saveMilliamps(device, profile->milliamps)) != MCP2221_SUCCESS)
+				return changed;
+		}
+	}
+
+	if(profile->fields & MCP2221_PROFILE_GPIOCONF)
+	{
+		mcp2221_gpioconfset_t current;
+		if((*res = mcp2221_loadGPIOConf(device, &current)) != MCP2221_SUCCESS)
+			return changed;
+
+		// Compare what would be written to flash, pins not in GPIO mode usually leave direction and value as invalid
+		// which the flash can't hold, so comparing the fields themselves would always find a difference
+		int different = 0;
+		for(int i=0;i<MCP2221_GPIO_COUNT;i++)
+		{
+			const mcp2221_gpioconf_t* conf = &profile->gpioConf.conf[i];
+			for(int pin=0;pin<MCP2221_GPIO_COUNT;pin++)
+			{
+				if(!(conf->gpios & (1<<pin)))
+					continue;
+				if(gpioConfValue(&current.conf[pin]) != gpioConfValue(conf))
+					different = 1;
+			}
+		}
+
+		if(different)
+		{
+			changed++;
+			if(apply && (*res = mcp2221_saveGPIOConf(device, (mcp2221_gpioconfset_t*)&profile->gpioConf)) != MCP2221_SUCCESS)
+				return changed;
+		}
+	}
+
+	return changed;
+}
+
+mcp2221_profile_t LIB_EXPORT mcp2221_profileInit()
+{
+	mcp2221_profile_t profile;
+	memset(&profile, 0x00, sizeof(mcp2221_profile_t));
+	profile.gpioConf = mcp2221_GPIOConfInit();
+	return profile;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_provision(mcp2221_t* device, const mcp2221_profile_t* profile, mcp2221_provision_result_t* result)
+{
+	if(!device || !profile)
+		return MCP2221_INVALID_ARG;
+
+	mcp2221_provision_result_t dummy;
+	if(!result)
+		result = &dummy;
+	memset(result, 0x00, sizeof(mcp2221_provision_result_t));
+
+	// Everything is read in one pipeline and then served from the flash cache, changes are written by mcp2221_flashCommit()
+	int cache = device->priv->flashCache;
+	mcp2221_setFlashCache(device, 1);
+
+	mcp2221_error res;
+	if((res = mcp2221_refreshFlash(device)) != MCP2221_SUCCESS || (res = mcp2221_flashBegin(device)) != MCP2221_SUCCESS)
+		goto done;
+
+	result->changed = diffProfile(device, profile, 1, &res);
+	if(res != MCP2221_SUCCESS)
+	{
+		mcp2221_flashCancel(device);
+		goto done;
+	}
+
+	if((res = mcp2221_flashCommit(device)) != MCP2221_SUCCESS)
+	{
+		mcp2221_flashCancel(device);
+		goto done;
+	}
+
+	// Read everything back to make sure the writes worked
+	if(result->changed)
+	{
+		if((res = mcp2221_refreshFlash(device)) != MCP2221_SUCCESS)
+			goto done;
+		if(diffProfile(device, profile, 0, &res) && res == MCP2221_SUCCESS)
+			res = MCP2221_ERROR_VERIFY;
+	}
+
+done:
+	mcp2221_setFlashCache(device, cache);
+	result->result = res;
+	return res;
+}
+
+static void provisionWorker(void* arg, int idx)
+{
+	provision_t* provision = arg;
+
+	mcp2221_provision_result_t* result = &provision->results[idx];
+	mcp2221_t* device = mcp2221_ctxOpen_byIndex(provision->ctx, idx);
+	if(!device)
+	{
+		memset(result, 0x00, sizeof(mcp2221_provision_result_t));
+		result->result = MCP2221_ERROR_HID;
+		return;
+	}
+
+	mcp2221_provision(device, provision->profile, result);
+	mcp2221_close(device);
+}
+
+mcp2221_error LIB_EXPORT mcp2221_ctxProvisionAll(mcp2221_ctx_t* ctx, const mcp2221_profile_t* profile, mcp2221_provision_result_t* results, int count)
+{
+	if(!ctx || !profile || !results || count < 0)
+		return MCP2221_INVALID_ARG;
+
+	provision_t provision;
+	provision.ctx = ctx;
+	provision.profile = profile;
+	provision.results = results;
+
+	// Each device spends most of its time waiting on USB, so a thread for each one (up to a limit) keeps them all busy
+	threadPool(count, provisionWorker, &provision);
+
+	for(int i=0;i<count;i++)
+	{
+		if(results[i].result != MCP2221_SUCCESS)
+			return MCP2221_ERROR;
+	}
+
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_provisionAll(const mcp2221_profile_t* profile, mcp2221_provision_result_t* results, int count)
+{
+	return mcp2221_ctxProvisionAll(getDefaultCtx(), profile, results, count);
+}
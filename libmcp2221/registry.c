@@ -0,0 +1,344 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Device registry, the list of devices found by mcp2221_find()
+// Entries live in an array and all of their strings in one arena, with hash indexes for looking them up by path, serial and factory serial
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <wchar.h>
+#include "internal.h"
+#include "thread.h"
+
+#define NO_KEY			SIZE_MAX
+#define INDEX_MIN_SIZE	16
+#define FNV_OFFSET		2166136261u
+#define FNV_PRIME		16777619u
+
+typedef enum
+{
+	INDEX_PATH,
+	INDEX_SERIAL,
+	INDEX_FACTORYSERIAL,
+	INDEX_COUNT
+}index_t;
+
+typedef struct{
+	size_t key[INDEX_COUNT];	// Arena offset of each string, NO_KEY if the device doesn't have it
+	size_t keyLen[INDEX_COUNT];	// Length in bytes, not including the terminator
+	uint32_t hash[INDEX_COUNT];
+	int removed;				// Device has been unplugged, the entry is kept so the other indexes don't move
+}entry_t;
+
+struct registry_t{
+	entry_t* entries;
+	int count;
+	int capacity;
+	char* arena;
+	size_t arenaUsed;
+	size_t arenaSize;
+	int* index[INDEX_COUNT];	// Open addressing hash tables of entry number + 1, 0 = empty slot
+	int indexSize;				// Always a power of 2 and at least double the entry count
+	mutex_t lock;
+};
+
+// FNV-1a
+static uint32_t hashBytes(const void* data, size_t len)
+{
+	const uint8_t* bytes = data;
+	uint32_t hash = FNV_OFFSET;
+	for(size_t i=0;i<len;i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+// Copy a string into the arena, returns its offset or NO_KEY if out of memory
+// Strings are aligned and terminated for wchar_t so the same arena works for both narrow and wide strings
+static size_t arenaAdd(registry_t* registry, const void* data, size_t len)
+{
+	size_t offset = (registry->arenaUsed + sizeof(wchar_t) - 1) & ~(sizeof(wchar_t) - 1);
+	size_t needed = offset + len + sizeof(wchar_t);
+
+	if(needed > registry->arenaSize)
+	{
+		size_t size = registry->arenaSize ? registry->arenaSize : 1024;
+		while(size < needed)
+			size *= 2;
+
+		char* arena = realloc(registry->arena, size);
+		if(!arena)
+			return NO_KEY;
+		registry->arena = arena;
+		registry->arenaSize = size;
+	}
+
+	memcpy(&registry->arena[offset], data, len);
+	memset(&registry->arena[offset + len], 0x00, sizeof(wchar_t));
+	registry->arenaUsed = needed;
+
+	return offset;
+}
+
+static void indexInsert(registry_t* registry, index_t which, int entry)
+{
+	const entry_t* e = &registry->entries[entry];
+	if(e->key[which] == NO_KEY)
+		return;
+
+	int mask = registry->indexSize - 1;
+	int* table = registry->index[which];
+	for(int slot = e->hash[which] & mask;;slot = (slot + 1) & mask)
+	{
+		if(!table[slot])
+		{
+			table[slot] = entry + 1;
+			break;
+		}
+	}
+}
+
+static int indexFind(registry_t* registry, index_t which, const void* key, size_t len)
+{
+	if(!registry->indexSize)
+		return -1;
+
+	int mask = registry->indexSize - 1;
+	int* table = registry->index[which];
+	for(int slot = hashBytes(key, len) & mask;table[slot];slot = (slot + 1) & mask)
+	{
+		const entry_t* e = &registry->entries[table[slot] - 1];
+		if(e->removed)
+			continue;
+		if(e->keyLen[which] == len && memcmp(&registry->arena[e->key[which]], key, len) == 0)
+			return table[slot] - 1;
+	}
+
+	return -1;
+}
+
+static void indexRebuild(registry_t* registry, index_t which)
+{
+	memset(registry->index[which], 0x00, registry->indexSize * sizeof(int));
+	for(int i=0;i<registry->count;i++)
+		indexInsert(registry, which, i);
+}
+
+// Make room for another entry, growing the array and hash tables if needed
+static int reserve(registry_t* registry)
+{
+	if(registry->count == registry->capacity)
+	{
+		int capacity = registry->capacity ? registry->capacity * 2 : INDEX_MIN_SIZE / 2;
+		entry_t* entries = realloc(registry->entries, capacity * sizeof(entry_t));
+		if(!entries)
+			return 0;
+		registry->entries = entries;
+		registry->capacity = capacity;
+	}
+
+	if((registry->count + 1) * 2 > registry->indexSize)
+	{
+		int size = registry->indexSize ? registry->indexSize * 2 : INDEX_MIN_SIZE;
+		for(int i=0;i<INDEX_COUNT;i++)
+		{
+			int* table = realloc(registry->index[i], size * sizeof(int));
+			if(!table)
+				return 0;
+			registry->index[i] = table;
+		}
+		registry->indexSize = size;
+		for(int i=0;i<INDEX_COUNT;i++)
+			indexRebuild(registry, i);
+	}
+
+	return 1;
+}
+
+static void setKey(registry_t* registry, entry_t* entry, index_t which, const void* key, size_t len)
+{
+	entry->key[which] = arenaAdd(registry, key, len);
+	entry->keyLen[which] = len;
+	entry->hash[which] = hashBytes(key, len);
+}
+
+static char* copyPath(registry_t* registry, int entry)
+{
+	if(entry < 0 || entry >= registry->count)
+		return NULL;
+
+	const entry_t* e = &registry->entries[entry];
+	if(e->removed)
+		return NULL;
+
+	char* path = malloc(e->keyLen[INDEX_PATH] + 1);
+	if(path)
+		memcpy(path, &registry->arena[e->key[INDEX_PATH]], e->keyLen[INDEX_PATH] + 1);
+	return path;
+}
+
+registry_t* registryCreate()
+{
+	registry_t* registry = calloc(1, sizeof(registry_t));
+	if(registry)
+		mutexInit(&registry->lock);
+	return registry;
+}
+
+void registryDestroy(registry_t* registry)
+{
+	if(!registry)
+		return;
+	mutexDestroy(&registry->lock);
+	for(int i=0;i<INDEX_COUNT;i++)
+		free(registry->index[i]);
+	free(registry->entries);
+	free(registry->arena);
+	free(registry);
+}
+
+// Forget all entries, the memory is kept for the next mcp2221_find()
+void registryClear(registry_t* registry)
+{
+	mutexLock(&registry->lock);
+	registry->count = 0;
+	registry->arenaUsed = 0;
+	for(int i=0;i<INDEX_COUNT;i++)
+	{
+		if(registry->index[i])
+			memset(registry->index[i], 0x00, registry->indexSize * sizeof(int));
+	}
+	mutexUnlock(&registry->lock);
+}
+
+static void setSerial(registry_t* registry, entry_t* entry, const wchar_t* serial)
+{
+	if(serial)
+		setKey(registry, entry, INDEX_SERIAL, serial, wcslen(serial) * sizeof(wchar_t));
+	else
+		entry->key[INDEX_SERIAL] = NO_KEY;
+}
+
+// Add a device, returns its index or -1 if out of memory
+// Adding a path that's already in the registry returns the existing index
+// A path that belonged to a device that was removed gets a new index, hidraw numbers get reused so it could be a different device
+// and handing it the old index would make mcp2221_open_byIndex() open the wrong one
+int registryAdd(registry_t* registry, const char* path, const wchar_t* serial)
+{
+	mutexLock(&registry->lock);
+
+	int entry = indexFind(registry, INDEX_PATH, path, strlen(path));
+	if(entry < 0 && reserve(registry))
+	{
+		entry_t* e = &registry->entries[registry->count];
+		setKey(registry, e, INDEX_PATH, path, strlen(path));
+		setSerial(registry, e, serial);
+		e->key[INDEX_FACTORYSERIAL] = NO_KEY;
+		e->removed = 0;
+
+		if(e->key[INDEX_PATH] != NO_KEY && (!serial || e->key[INDEX_SERIAL] != NO_KEY))
+		{
+			entry = registry->count++;
+			for(int i=0;i<INDEX_COUNT;i++)
+				indexInsert(registry, i, entry);
+		}
+	}
+
+	mutexUnlock(&registry->lock);
+
+	return entry;
+}
+
+// Mark a device as removed, returns its index or -1 if it wasn't in the registry
+// The index isn't reused by other devices so mcp2221_open_byIndex() keeps working for everything else
+int registryRemove(registry_t* registry, const char* path)
+{
+	mutexLock(&registry->lock);
+
+	int entry = indexFind(registry, INDEX_PATH, path, strlen(path));
+	if(entry >= 0)
+		registry->entries[entry].removed = 1;
+
+	mutexUnlock(&registry->lock);
+
+	return entry;
+}
+
+// Index of a device that's in the registry and hasn't been removed, -1 if not found
+int registryFindPath(registry_t* registry, const char* path)
+{
+	mutexLock(&registry->lock);
+	int entry = indexFind(registry, INDEX_PATH, path, strlen(path));
+	mutexUnlock(&registry->lock);
+	return entry;
+}
+
+// Number of entries, including removed ones (which are still taking up an index)
+int registryCount(registry_t* registry)
+{
+	mutexLock(&registry->lock);
+	int count = registry->count;
+	mutexUnlock(&registry->lock);
+	return count;
+}
+
+// The lookup functions return a copy of the path, free() it when done
+// A copy is needed since the arena can move if another thread adds a factory serial
+
+char* registryPath(registry_t* registry, int idx)
+{
+	mutexLock(&registry->lock);
+	char* path = copyPath(registry, idx);
+	mutexUnlock(&registry->lock);
+	return path;
+}
+
+char* registryFindSerial(registry_t* registry, const wchar_t* serial)
+{
+	mutexLock(&registry->lock);
+	char* path = copyPath(registry, indexFind(registry, INDEX_SERIAL, serial, wcslen(serial) * sizeof(wchar_t)));
+	mutexUnlock(&registry->lock);
+	return path;
+}
+
+char* registryFindFactorySerial(registry_t* registry, const char* factorySerial)
+{
+	mutexLock(&registry->lock);
+	char* path = copyPath(registry, indexFind(registry, INDEX_FACTORYSERIAL, factorySerial, strlen(factorySerial)));
+	mutexUnlock(&registry->lock);
+	return path;
+}
+
+// The factory serial isn't known until a device has been opened, so it's filled in afterwards
+void registrySetFactorySerial(registry_t* registry, const char* path, const char* factorySerial)
+{
+	mutexLock(&registry->lock);
+
+	int entry = indexFind(registry, INDEX_PATH, path, strlen(path));
+	if(entry >= 0)
+	{
+		entry_t* e = &registry->entries[entry];
+		size_t len = strlen(factorySerial);
+		int known = (e->key[INDEX_FACTORYSERIAL] != NO_KEY);
+		if(!known || e->keyLen[INDEX_FACTORYSERIAL] != len || memcmp(&registry->arena[e->key[INDEX_FACTORYSERIAL]], factorySerial, len) != 0)
+		{
+			setKey(registry, e, INDEX_FACTORYSERIAL, factorySerial, len);
+
+			// Entries can't be taken out of the table, but a device's factory serial changing means something strange has happened anyway
+			if(known)
+				indexRebuild(registry, INDEX_FACTORYSERIAL);
+			else
+				indexInsert(registry, INDEX_FACTORYSERIAL, entry);
+		}
+	}
+
+	mutexUnlock(&registry->lock);
+}
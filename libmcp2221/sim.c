@@ -0,0 +1,541 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Software MCP2221, used for testing and benchmarking without any hardware
+
+#ifndef _WIN32
+	#define _POSIX_C_SOURCE 200809L
+	#include <unistd.h>
+	#include <fcntl.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "libmcp2221.h"
+#include "internal.h"
+
+#define SIM_MAX_SLAVES		8
+#define SIM_RESPONSE_QUEUE	16 // Must be a power of 2
+
+// Offsets into the GETSRAM report
+#define SRAM_CLOCK		5
+#define SRAM_DAC		6
+#define SRAM_ADCINT		7
+#define SRAM_GPIO		22
+
+typedef struct{
+	int address;
+	mcp2221_sim_i2cwrite_t writeFunc;
+	mcp2221_sim_i2cread_t readFunc;
+	void* userData;
+}sim_slave_t;
+
+typedef struct{
+	uint8_t flash[FLASH_SECTION_COUNT][REPORT_SIZE];	// Flash sections, in READFLASH response format
+	uint8_t sram[REPORT_SIZE];							// SRAM settings, in GETSRAM response format
+	uint8_t inputs[MCP2221_GPIO_COUNT];					// Level seen by pins configured as inputs
+	int adc[MCP2221_ADC_COUNT];
+	uint8_t intFlag;
+	uint8_t i2cState;
+	uint8_t i2cDiv;
+	uint8_t i2cData[60];
+	int i2cDataLen;
+	sim_slave_t slaves[SIM_MAX_SLAVES];
+	int slaveCount;
+	uint8_t responses[SIM_RESPONSE_QUEUE][REPORT_SIZE];	// Responses waiting to be read, the real chip queues them up in the same way
+	unsigned int head;
+	unsigned int tail;
+	int pipeFds[2];		// Only created if mcp2221_getPollFd() is called, has a byte in it for each waiting response
+	uint8_t password[MCP2221_PASSWORD_LEN];	// Flash password, not readable through READFLASH
+	int unlocked;		// Correct password has been sent since power-up
+	int passAttempts;	// Wrong passwords sent since power-up, the chip gives up after 3
+	int gone;			// Reset has been sent, the real chip drops off the bus and comes back as a new USB device
+}sim_t;
+
+static void setDescriptor(uint8_t* section, const wchar_t* str)
+{
+	int len = wcslen(str);
+	section[2] = (len * 2) + 2;
+	section[3] = 0x03;
+	for(int i=0;i<len;i++)
+	{
+		section[4 + (i * 2)] = str[i];
+		section[5 + (i * 2)] = str[i]>>8;
+	}
+}
+
+// Factory default flash contents
+static void initFlash(sim_t* sim)
+{
+	uint8_t* chip = sim->flash[FLASH_SECTION_CHIPSETTINGS];
+	chip[2] = 10;
+	chip[4] = 0x00;	// No serial enumeration, LED polarities low, unsecured
+	chip[5] = MCP2221_CLKDUTY_50 | MCP2221_CLKDIV_8;
+	chip[6] = 0x00;
+	chip[7] = 0x00;
+	chip[8] = MCP2221_DEFAULT_VID & 0xFF;
+	chip[9] = MCP2221_DEFAULT_VID>>8;
+	chip[10] = MCP2221_DEFAULT_PID & 0xFF;
+	chip[11] = MCP2221_DEFAULT_PID>>8;
+	chip[12] = 0x80; // Bus powered
+	chip[13] = 100 / 2;
+
+	uint8_t* gpio = sim->flash[FLASH_SECTION_GPIOSETTINGS];
+	gpio[2] = 4;
+	for(int i=0;i<MCP2221_GPIO_COUNT;i++)
+		gpio[4 + i] = 0x08 | MCP2221_GPIO_MODE_GPIO; // GPIO input
+
+	setDescriptor(sim->flash[FLASH_SECTION_USBMANUFACTURER], MCP2221_DEFAULT_MANUFACTURER);
+	setDescriptor(sim->flash[FLASH_SECTION_USBPRODUCT], MCP2221_DEFAULT_PRODUCT);
+	setDescriptor(sim->flash[FLASH_SECTION_USBSERIAL], L"0001234567");
+
+	uint8_t* factory = sim->flash[FLASH_SECTION_FACTORYSERIAL];
+	factory[2] = 8;
+	memcpy(&factory[4], "SIM00001", 8);
+}
+
+// Power-up/reset, SRAM is loaded from flash
+static void initSRAM(sim_t* sim)
+{
+	memset(sim->sram, 0x00, REPORT_SIZE);
+	sim->sram[0] = USB_CMD_GETSRAM;
+	sim->sram[2] = 18;
+	memcpy(&sim->sram[4], &sim->flash[FLASH_SECTION_CHIPSETTINGS][4], 10);
+	memcpy(&sim->sram[SRAM_GPIO], &sim->flash[FLASH_SECTION_GPIOSETTINGS][4], MCP2221_GPIO_COUNT);
+	sim->intFlag = 0;
+	sim->i2cState = MCP2221_I2C_IDLE;
+	sim->i2cDataLen = 0;
+	sim->unlocked = 0;
+	sim->passAttempts = 0;
+}
+
+static sim_slave_t* findSlave(sim_t* sim, int address)
+{
+	for(int i=0;i<sim->slaveCount;i++)
+	{
+		if(sim->slaves[i].address == address)
+			return &sim->slaves[i];
+	}
+	return NULL;
+}
+
+static void cmdStatusSet(sim_t* sim, const uint8_t* cmd, uint8_t* resp)
+{
+	if(cmd[2] == 0x10) // Cancel current I2C transfer
+	{
+		sim->i2cState = MCP2221_I2C_IDLE;
+		sim->i2cDataLen = 0;
+		resp[2] = 0x10;
+	}
+
+	if(cmd[3] == 0x20) // Set I2C speed
+	{
+		sim->i2cDiv = cmd[4];
+		resp[3] = 0x20;
+	}
+
+	resp[8] = sim->i2cState;
+	resp[14] = sim->i2cDiv;
+	resp[22] = 1; // SCL and SDA idle high
+	resp[23] = 1;
+	resp[24] = sim->intFlag;
+	resp[46] = 'A';
+	resp[47] = '6';
+	resp[48] = '1';
+	resp[49] = '2';
+	for(int i=0;i<MCP2221_ADC_COUNT;i++)
+	{
+		resp[50 + (i * 2)] = sim->adc[i];
+		resp[51 + (i * 2)] = sim->adc[i]>>8;
+	}
+}
+
+static void cmdSetSRAM(sim_t* sim, const uint8_t* cmd)
+{
+	uint8_t* sram = sim->sram;
+
+	if(cmd[2] & 0x80) // Clock output
+		sram[SRAM_CLOCK] = cmd[2] & 0x1F;
+
+	if(cmd[3] & 0x80) // DAC reference
+		sram[SRAM_DAC] = (sram[SRAM_DAC] & 0x1F) | ((cmd[3] & 0x07)<<5);
+
+	if(cmd[4] & 0x80) // DAC value
+		sram[SRAM_DAC] = (sram[SRAM_DAC] & 0xE0) | (cmd[4] & 0x1F);
+
+	if(cmd[5] & 0x80) // ADC reference
+		sram[SRAM_ADCINT] = (sram[SRAM_ADCINT] & ~0x1C) | ((cmd[5] & 0x07)<<2);
+
+	if(cmd[6] & 0x80) // Interrupt
+	{
+		if(cmd[6] & 0x10)
+			sram[SRAM_ADCINT] = (sram[SRAM_ADCINT] & ~0x20) | ((cmd[6] & 0x08) ? 0x20 : 0);
+		if(cmd[6] & 0x04)
+			sram[SRAM_ADCINT] = (sram[SRAM_ADCINT] & ~0x40) | ((cmd[6] & 0x02) ? 0x40 : 0);
+		if(cmd[6] & 0x01)
+			sim->intFlag = 0;
+	}
+
+	if(cmd[7] & 0x80) // GPIO
+		memcpy(&sram[SRAM_GPIO], &cmd[8], MCP2221_GPIO_COUNT);
+}
+
+static void cmdSetGPIO(sim_t* sim, const uint8_t* cmd)
+{
+	for(int i=0;i<MCP2221_GPIO_COUNT;i++)
+	{
+		const uint8_t* pin = &cmd[2 + (i * 4)];
+		uint8_t* val = &sim->sram[SRAM_GPIO + i];
+
+		if(pin[0]) // Alter output
+			*val = (*val & ~16) | (pin[1] ? 16 : 0);
+		if(pin[2]) // Alter direction
+			*val = (*val & ~8) | (pin[3] ? 8 : 0);
+	}
+}
+
+static void cmdGetGPIO(sim_t* sim, uint8_t* resp)
+{
+	for(int i=0;i<MCP2221_GPIO_COUNT;i++)
+	{
+		uint8_t val = sim->sram[SRAM_GPIO + i];
+		if((val & 7) != MCP2221_GPIO_MODE_GPIO)
+		{
+			resp[2 + (i * 2)] = MCP2221_GPIO_VALUE_INVALID;
+			resp[3 + (i * 2)] = MCP2221_GPIO_DIR_INVALID;
+		}
+		else if(val & 8)
+		{
+			resp[2 + (i * 2)] = sim->inputs[i];
+			resp[3 + (i * 2)] = MCP2221_GPIO_DIR_INPUT;
+		}
+		else
+		{
+			resp[2 + (i * 2)] = !!(val & 16);
+			resp[3 + (i * 2)] = MCP2221_GPIO_DIR_OUTPUT;
+		}
+	}
+}
+
+static void cmdWriteFlash(sim_t* sim, const uint8_t* cmd, uint8_t* resp)
+{
+	// Security bits, 0 = unsecured, 1 = password protected, 2 and 3 = permanently locked
+	uint8_t security = sim->flash[FLASH_SECTION_CHIPSETTINGS][4] & 0x03;
+	if(security > 1 || (security == 1 && !sim->unlocked))
+	{
+		resp[1] = 0x03;
+		return;
+	}
+
+	uint8_t section = cmd[1];
+	switch(section)
+	{
+		case FLASH_SECTION_CHIPSETTINGS:
+			memcpy(&sim->flash[section][4], &cmd[2], 10);
+			// Bytes 12 - 19 are the new password when password protection is selected
+			if((cmd[2] & 0x03) == 1)
+				memcpy(sim->password, &cmd[12], MCP2221_PASSWORD_LEN);
+			break;
+		case FLASH_SECTION_GPIOSETTINGS:
+			memcpy(&sim->flash[section][4], &cmd[2], REPORT_SIZE - 4);
+			break;
+		case FLASH_SECTION_USBMANUFACTURER:
+		case FLASH_SECTION_USBPRODUCT:
+		case FLASH_SECTION_USBSERIAL:
+			memcpy(&sim->flash[section][2], &cmd[2], REPORT_SIZE - 2);
+			break;
+		default: // Factory serial is read-only
+			resp[1] = 0x03;
+			break;
+	}
+}
+
+static void cmdFlashPass(sim_t* sim, const uint8_t* cmd, uint8_t* resp)
+{
+	if(sim->passAttempts >= 3 || memcmp(sim->password, &cmd[2], MCP2221_PASSWORD_LEN) != 0)
+	{
+		sim->passAttempts++;
+		resp[1] = 0x03;
+		return;
+	}
+	sim->unlocked = 1;
+}
+
+static void cmdI2CWrite(sim_t* sim, const uint8_t* cmd)
+{
+	int len = cmd[1] | (cmd[2]<<8);
+	if(len > 60)
+		len = 60;
+
+	sim_slave_t* slave = findSlave(sim, cmd[3]>>1);
+	if(!slave || (slave->writeFunc && slave->writeFunc(slave->userData, &cmd[4], len) != 0))
+		sim->i2cState = MCP2221_I2C_ADDRNOTFOUND;
+	else
+		sim->i2cState = MCP2221_I2C_IDLE;
+}
+
+static void cmdI2CRead(sim_t* sim, const uint8_t* cmd)
+{
+	int len = cmd[1] | (cmd[2]<<8);
+	if(len > 60)
+		len = 60;
+
+	sim->i2cDataLen = 0;
+	memset(sim->i2cData, 0xFF, sizeof(sim->i2cData));
+
+	sim_slave_t* slave = findSlave(sim, cmd[3]>>1);
+	if(!slave || (slave->readFunc && slave->readFunc(slave->userData, sim->i2cData, len) != 0))
+		sim->i2cState = MCP2221_I2C_ADDRNOTFOUND;
+	else
+	{
+		sim->i2cDataLen = len;
+		sim->i2cState = MCP2221_I2C_DATAREADY;
+	}
+}
+
+static void cmdI2CGet(sim_t* sim, uint8_t* resp)
+{
+	if(sim->i2cState != MCP2221_I2C_DATAREADY)
+	{
+		resp[1] = 0x41; // Error reading from the I2C engine
+		return;
+	}
+
+	resp[2] = sim->i2cState;
+	resp[3] = sim->i2cDataLen;
+	memcpy(&resp[4], sim->i2cData, sim->i2cDataLen);
+	sim->i2cDataLen = 0;
+	sim->i2cState = MCP2221_I2C_IDLE;
+}
+
+static mcp2221_error simSend(void* handle, uint8_t* report)
+{
+	sim_t* sim = handle;
+
+	if(sim->gone)
+		return MCP2221_ERROR_HID;
+	else if(sim->head - sim->tail >= SIM_RESPONSE_QUEUE) // Nobody is reading the responses
+		return MCP2221_ERROR_HID;
+
+	// The chip resets straight away without sending a response
+	if(report[0] == USB_CMD_RESET)
+	{
+		sim->gone = 1;
+		return MCP2221_SUCCESS;
+	}
+
+	uint8_t* resp = sim->responses[sim->head % SIM_RESPONSE_QUEUE];
+	memset(resp, 0x00, REPORT_SIZE);
+	resp[0] = report[0];
+
+	switch(report[0])
+	{
+		case USB_CMD_STATUSSET:
+			cmdStatusSet(sim, report, resp);
+			break;
+		case USB_CMD_GETSRAM:
+			memcpy(&resp[1], &sim->sram[1], REPORT_SIZE - 1);
+			break;
+		case USB_CMD_SETSRAM:
+			cmdSetSRAM(sim, report);
+			break;
+		case USB_CMD_SETGPIO:
+			cmdSetGPIO(sim, report);
+			memcpy(&resp[2], &report[2], MCP2221_GPIO_COUNT * 4);
+			break;
+		case USB_CMD_GETGPIO:
+			cmdGetGPIO(sim, resp);
+			break;
+		case USB_CMD_READFLASH:
+			if(report[1] < FLASH_SECTION_COUNT)
+				memcpy(&resp[2], &sim->flash[report[1]][2], REPORT_SIZE - 2);
+			else
+				resp[1] = 0x01;
+			break;
+		case USB_CMD_WRITEFLASH:
+			cmdWriteFlash(sim, report, resp);
+			break;
+		case USB_CMD_FLASHPASS:
+			cmdFlashPass(sim, report, resp);
+			break;
+		case USB_CMD_I2CWRITE:
+		case USB_CMD_I2CWRITE_REPEATSTART:
+		case USB_CMD_I2CWRITE_NOSTOP:
+			cmdI2CWrite(sim, report);
+			break;
+		case USB_CMD_I2CREAD:
+		case USB_CMD_I2CREAD_REPEATSTART:
+			cmdI2CRead(sim, report);
+			break;
+		case USB_CMD_I2CREAD_GET:
+			cmdI2CGet(sim, resp);
+			break;
+		default:
+			resp[1] = 0x01; // Unknown command
+			break;
+	}
+
+	sim->head++;
+
+#ifndef _WIN32
+	if(sim->pipeFds[1] >= 0 && write(sim->pipeFds[1], "", 1) != 1)
+		return MCP2221_ERROR_HID;
+#endif
+
+	return MCP2221_SUCCESS;
+}
+
+static mcp2221_error simReceive(void* handle, uint8_t* report, int timeout)
+{
+	UNUSED(timeout);
+
+	sim_t* sim = handle;
+
+	// Responses are generated as soon as the command is sent, so if there's nothing here then nothing will ever turn up
+	if(sim->head == sim->tail)
+		return sim->gone ? MCP2221_ERROR_HID : MCP2221_ERROR_TIMEOUT;
+
+	memcpy(report, sim->responses[sim->tail % SIM_RESPONSE_QUEUE], REPORT_SIZE);
+	sim->tail++;
+
+#ifndef _WIN32
+	uint8_t tmp;
+	if(sim->pipeFds[0] >= 0 && read(sim->pipeFds[0], &tmp, 1) != 1)
+		return MCP2221_ERROR_HID;
+#endif
+
+	return MCP2221_SUCCESS;
+}
+
+static void simClose(void* handle)
+{
+	sim_t* sim = handle;
+#ifndef _WIN32
+	if(sim->pipeFds[0] >= 0)
+	{
+		close(sim->pipeFds[0]);
+		close(sim->pipeFds[1]);
+	}
+#endif
+	free(sim);
+}
+
+static int simPollFd(void* handle)
+{
+#ifdef _WIN32
+	UNUSED(handle);
+	return -1;
+#else
+	sim_t* sim = handle;
+	if(sim->pipeFds[0] < 0)
+	{
+		if(pipe(sim->pipeFds) != 0)
+		{
+			sim->pipeFds[0] = sim->pipeFds[1] = -1;
+			return -1;
+		}
+		fcntl(sim->pipeFds[0], F_SETFD, FD_CLOEXEC);
+		fcntl(sim->pipeFds[1], F_SETFD, FD_CLOEXEC);
+
+		// Responses that are already waiting
+		for(unsigned int i=sim->tail;i!=sim->head;i++)
+		{
+			if(write(sim->pipeFds[1], "", 1) != 1)
+				return -1;
+		}
+	}
+	return sim->pipeFds[0];
+#endif
+}
+
+static const mcp2221_transport_t simTransport = {
+	.send = simSend,
+	.receive = simReceive,
+	.close = simClose,
+	.pollFd = simPollFd
+};
+
+static sim_t* getSim(mcp2221_t* device)
+{
+	if(!device || device->priv->transport != &simTransport)
+		return NULL;
+	return device->handle;
+}
+
+mcp2221_t* LIB_EXPORT mcp2221_open_sim()
+{
+	sim_t* sim = calloc(1, sizeof(sim_t));
+	if(!sim)
+		return NULL;
+
+	sim->pipeFds[0] = sim->pipeFds[1] = -1;
+	initFlash(sim);
+	initSRAM(sim);
+
+	return mcp2221_open_transport(&simTransport, sim, NULL);
+}
+
+mcp2221_error LIB_EXPORT mcp2221_simAddI2CSlave(mcp2221_t* device, int address, mcp2221_sim_i2cwrite_t writeFunc, mcp2221_sim_i2cread_t readFunc, void* userData)
+{
+	sim_t* sim = getSim(device);
+	if(!sim || address < 0 || address > 127)
+		return MCP2221_INVALID_ARG;
+
+	sim_slave_t* slave = findSlave(sim, address);
+	if(!slave)
+	{
+		if(sim->slaveCount >= SIM_MAX_SLAVES)
+			return MCP2221_ERROR;
+		slave = &sim->slaves[sim->slaveCount++];
+	}
+
+	slave->address = address;
+	slave->writeFunc = writeFunc;
+	slave->readFunc = readFunc;
+	slave->userData = userData;
+
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_simSetADC(mcp2221_t* device, int values[MCP2221_ADC_COUNT])
+{
+	sim_t* sim = getSim(device);
+	if(!sim || !values)
+		return MCP2221_INVALID_ARG;
+
+	for(int i=0;i<MCP2221_ADC_COUNT;i++)
+		sim->adc[i] = values[i] & 0x3FF;
+
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_simSetInput(mcp2221_t* device, mcp2221_gpio_t pins, mcp2221_gpio_value_t value)
+{
+	sim_t* sim = getSim(device);
+	if(!sim)
+		return MCP2221_INVALID_ARG;
+
+	for(int i=0;i<MCP2221_GPIO_COUNT;i++)
+	{
+		if(pins & (1 << i))
+			sim->inputs[i] = (value == MCP2221_GPIO_VALUE_HIGH);
+	}
+
+	return MCP2221_SUCCESS;
+}
+
+mcp2221_error LIB_EXPORT mcp2221_simTriggerInterrupt(mcp2221_t* device)
+{
+	sim_t* sim = getSim(device);
+	if(!sim)
+		return MCP2221_INVALID_ARG;
+
+	sim->intFlag = 1;
+
+	return MCP2221_SUCCESS;
+}
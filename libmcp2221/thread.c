@@ -0,0 +1,221 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+#include <limits.h>
+#include "thread.h"
+
+#ifdef _WIN32
+
+static DWORD WINAPI threadEntry(LPVOID param)
+{
+	thread_t* thread = param;
+	thread->func(thread->arg);
+	return 0;
+}
+
+int threadCreate(thread_t* thread, thread_func_t func, void* arg)
+{
+	thread->func = func;
+	thread->arg = arg;
+	thread->handle = CreateThread(NULL, 0, threadEntry, thread, 0, NULL);
+	return thread->handle != NULL;
+}
+
+void threadJoin(thread_t* thread)
+{
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+}
+
+void threadDetach(thread_t* thread)
+{
+	CloseHandle(thread->handle);
+}
+
+int threadIsCurrent(thread_t* thread)
+{
+	return GetThreadId(thread->handle) == GetCurrentThreadId();
+}
+
+void mutexInit(mutex_t* mutex)
+{
+	InitializeCriticalSection(&mutex->cs);
+}
+
+void mutexDestroy(mutex_t* mutex)
+{
+	DeleteCriticalSection(&mutex->cs);
+}
+
+void mutexLock(mutex_t* mutex)
+{
+	EnterCriticalSection(&mutex->cs);
+}
+
+void mutexUnlock(mutex_t* mutex)
+{
+	LeaveCriticalSection(&mutex->cs);
+}
+
+void signalInit(signal_t* signal)
+{
+	signal->handle = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+}
+
+void signalDestroy(signal_t* signal)
+{
+	CloseHandle(signal->handle);
+}
+
+void signalPost(signal_t* signal)
+{
+	ReleaseSemaphore(signal->handle, 1, NULL);
+}
+
+void signalWait(signal_t* signal)
+{
+	WaitForSingleObject(signal->handle, INFINITE);
+}
+
+#else
+
+static void* threadEntry(void* param)
+{
+	thread_t* thread = param;
+	thread->func(thread->arg);
+	return NULL;
+}
+
+int threadCreate(thread_t* thread, thread_func_t func, void* arg)
+{
+	thread->func = func;
+	thread->arg = arg;
+	return pthread_create(&thread->handle, NULL, threadEntry, thread) == 0;
+}
+
+void threadJoin(thread_t* thread)
+{
+	pthread_join(thread->handle, NULL);
+}
+
+void threadDetach(thread_t* thread)
+{
+	pthread_detach(thread->handle);
+}
+
+int threadIsCurrent(thread_t* thread)
+{
+	return pthread_equal(thread->handle, pthread_self());
+}
+
+void mutexInit(mutex_t* mutex)
+{
+	pthread_mutex_init(&mutex->mutex, NULL);
+}
+
+void mutexDestroy(mutex_t* mutex)
+{
+	pthread_mutex_destroy(&mutex->mutex);
+}
+
+void mutexLock(mutex_t* mutex)
+{
+	pthread_mutex_lock(&mutex->mutex);
+}
+
+void mutexUnlock(mutex_t* mutex)
+{
+	pthread_mutex_unlock(&mutex->mutex);
+}
+
+void signalInit(signal_t* signal)
+{
+	pthread_mutex_init(&signal->mutex, NULL);
+	pthread_cond_init(&signal->cond, NULL);
+	signal->count = 0;
+}
+
+void signalDestroy(signal_t* signal)
+{
+	pthread_cond_destroy(&signal->cond);
+	pthread_mutex_destroy(&signal->mutex);
+}
+
+void signalPost(signal_t* signal)
+{
+	pthread_mutex_lock(&signal->mutex);
+	signal->count++;
+	pthread_cond_signal(&signal->cond);
+	pthread_mutex_unlock(&signal->mutex);
+}
+
+void signalWait(signal_t* signal)
+{
+	pthread_mutex_lock(&signal->mutex);
+	while(!signal->count)
+		pthread_cond_wait(&signal->cond, &signal->mutex);
+	signal->count--;
+	pthread_mutex_unlock(&signal->mutex);
+}
+
+#endif
+
+#define POOL_MAX_THREADS	32
+
+typedef struct{
+	pool_func_t func;
+	void* arg;
+	int count;
+	int next;		// Next item to be picked up by a worker
+	mutex_t lock;
+}pool_t;
+
+static void poolWorker(void* arg)
+{
+	pool_t* pool = arg;
+
+	while(1)
+	{
+		mutexLock(&pool->lock);
+		int idx = pool->next++;
+		mutexUnlock(&pool->lock);
+
+		if(idx >= pool->count)
+			break;
+
+		pool->func(pool->arg, idx);
+	}
+}
+
+void threadPool(int count, pool_func_t func, void* arg)
+{
+	pool_t pool;
+	pool.func = func;
+	pool.arg = arg;
+	pool.count = count;
+	pool.next = 0;
+	mutexInit(&pool.lock);
+
+	int threadCount = (count < POOL_MAX_THREADS) ? count : POOL_MAX_THREADS;
+	thread_t threads[POOL_MAX_THREADS];
+	int started = 0;
+	for(;started<threadCount;started++)
+	{
+		if(!threadCreate(&threads[started], poolWorker, &pool))
+			break;
+	}
+
+	// Do the work here if no threads could be created
+	if(!started)
+		poolWorker(&pool);
+
+	for(int i=0;i<started;i++)
+		threadJoin(&threads[i]);
+
+	mutexDestroy(&pool.lock);
+}
@@ -0,0 +1,70 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+#ifndef THREAD_H_
+#define THREAD_H_
+
+// Just enough threading stuff for the library, pthreads on Linux/Mac and Win32 threads on Windows
+
+#ifdef _WIN32
+	#include "win/win.h"
+#else
+	#include <pthread.h>
+#endif
+
+typedef void (*thread_func_t)(void* arg);
+typedef void (*pool_func_t)(void* arg, int idx);
+
+typedef struct{
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+	thread_func_t func;
+	void* arg;
+}thread_t;
+
+typedef struct{
+#ifdef _WIN32
+	CRITICAL_SECTION cs;
+#else
+	pthread_mutex_t mutex;
+#endif
+}mutex_t;
+
+// Counting semaphore
+typedef struct{
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned int count;
+#endif
+}signal_t;
+
+int threadCreate(thread_t* thread, thread_func_t func, void* arg);
+void threadJoin(thread_t* thread);
+void threadDetach(thread_t* thread);
+int threadIsCurrent(thread_t* thread);
+
+// Run func for each idx from 0 to count - 1 on a pool of threads, returns once they're all done
+void threadPool(int count, pool_func_t func, void* arg);
+
+void mutexInit(mutex_t* mutex);
+void mutexDestroy(mutex_t* mutex);
+void mutexLock(mutex_t* mutex);
+void mutexUnlock(mutex_t* mutex);
+
+void signalInit(signal_t* signal);
+void signalDestroy(signal_t* signal);
+void signalPost(signal_t* signal);
+void signalWait(signal_t* signal);
+
+#endif /* THREAD_H_ */
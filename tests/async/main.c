@@ -0,0 +1,149 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Async I/O thread tests, run against the simulator so no hardware is needed
+
+#include <stdio.h>
+#include "../../libmcp2221/libmcp2221.h"
+
+static int failed;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if(!ok)
+		failed++;
+}
+
+static mcp2221_error stopJob(mcp2221_t* myDev, void* arg)
+{
+	(void)arg;
+	mcp2221_asyncStop(myDev);
+	return MCP2221_SUCCESS;
+}
+
+static mcp2221_error closeJob(mcp2221_t* myDev, void* arg)
+{
+	(void)arg;
+	mcp2221_close(myDev);
+	return MCP2221_SUCCESS;
+}
+
+static mcp2221_error dacJob(mcp2221_t* myDev, void* arg)
+{
+	return mcp2221_setDAC(myDev, MCP2221_DAC_REF_VDD, *(int*)arg);
+}
+
+static void countCallback(mcp2221_t* myDev, mcp2221_error result, void* userData)
+{
+	(void)myDev;
+	if(result == MCP2221_SUCCESS)
+		(*(int*)userData)++;
+}
+
+typedef struct{
+	mcp2221_job_t first;
+	int value;
+	int done;
+	mcp2221_request_t* dac;
+}queue_t;
+
+// Queues a job followed by a DAC write, nothing runs until this returns so the order is fixed
+static mcp2221_error queueJob(mcp2221_t* myDev, void* arg)
+{
+	queue_t* queue = arg;
+	mcp2221_error res = mcp2221_asyncSubmit(myDev, queue->first, NULL, NULL, NULL, NULL);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_asyncSubmit(myDev, dacJob, &queue->value, countCallback, &queue->done, &queue->dac);
+	return res;
+}
+
+// Run queueJob() on a new simulator
+static mcp2221_t* openAndQueue(queue_t* queue)
+{
+	mcp2221_t* myDev = mcp2221_open_sim();
+	if(!myDev || mcp2221_asyncStart(myDev) != MCP2221_SUCCESS)
+	{
+		mcp2221_close(myDev);
+		return NULL;
+	}
+
+	mcp2221_request_t* request;
+	mcp2221_error res = mcp2221_asyncSubmit(myDev, queueJob, queue, NULL, NULL, &request);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_asyncWait(request);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_asyncWait(queue->dac);
+	if(res != MCP2221_SUCCESS)
+	{
+		mcp2221_close(myDev);
+		return NULL;
+	}
+	return myDev;
+}
+
+// Stopping from a job doesn't wait for itself, closing from the main thread afterwards cleans up
+static void testStopFromJobThenClose(void)
+{
+	queue_t queue = {stopJob, 7, 0, NULL};
+	mcp2221_t* myDev = openAndQueue(&queue);
+	check(myDev && queue.done == 1, "jobs queued before a stop from a job still run");
+	if(!myDev)
+		return;
+
+	check(mcp2221_asyncSubmit(myDev, dacJob, &queue.value, NULL, NULL, NULL) == MCP2221_ERROR, "nothing new is accepted after stopping");
+
+	mcp2221_close(myDev);
+	check(1, "close from the main thread after stopping from a job");
+}
+
+// A thread stopped from a job can be replaced by a new one
+static void testStopFromJobThenRestart(void)
+{
+	queue_t queue = {stopJob, 3, 0, NULL};
+	mcp2221_t* myDev = openAndQueue(&queue);
+	if(!myDev)
+	{
+		check(0, "stop from a job");
+		return;
+	}
+
+	mcp2221_asyncStop(myDev);
+
+	mcp2221_request_t* request;
+	mcp2221_error res = mcp2221_asyncStart(myDev);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_asyncSubmit(myDev, dacJob, &queue.value, NULL, NULL, &request);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_asyncWait(request);
+	check(res == MCP2221_SUCCESS, "restart after stopping from a job");
+
+	mcp2221_close(myDev);
+}
+
+// Closing from a job is deferred until the queue has finished, the device must not be touched afterwards
+static void testCloseFromJob(void)
+{
+	queue_t queue = {closeJob, 5, 0, NULL};
+	mcp2221_t* myDev = openAndQueue(&queue);
+	check(myDev && queue.done == 1, "close from a job runs the rest of the queue first");
+}
+
+int main(void)
+{
+	mcp2221_init();
+
+	testStopFromJobThenClose();
+	testStopFromJobThenRestart();
+	testCloseFromJob();
+
+	mcp2221_exit();
+
+	printf("%d failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// SRAM cache, write suppression and flash cache tests, run against the simulator so no hardware is needed
+
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include "../../libmcp2221/libmcp2221.h"
+
+#define LINK_QUEUE	8
+
+// Transport that passes reports on to a simulator and counts them, to see which calls do USB transactions
+typedef struct{
+	mcp2221_t* sim;
+	uint8_t ready[LINK_QUEUE][MCP2221_REPORT_SIZE];	// Responses waiting to be received
+	int readyCount;
+	int sends;		// Reports sent so far
+}link_t;
+
+static int failed;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if(!ok)
+		failed++;
+}
+
+static mcp2221_error linkSend(void* handle, uint8_t* report)
+{
+	link_t* link = handle;
+	link->sends++;
+
+	if(link->readyCount >= LINK_QUEUE)
+		return MCP2221_ERROR_HID;
+
+	uint8_t* response = link->ready[link->readyCount];
+	memcpy(response, report, MCP2221_REPORT_SIZE);
+	mcp2221_error res = mcp2221_rawReport(link->sim, response);
+	if(res != MCP2221_SUCCESS && res != MCP2221_ERROR_STATUS)
+		return MCP2221_ERROR_HID;
+
+	link->readyCount++;
+	return MCP2221_SUCCESS;
+}
+
+static mcp2221_error linkReceive(void* handle, uint8_t* report, int timeout)
+{
+	link_t* link = handle;
+	(void)timeout;
+
+	if(!link->readyCount)
+		return MCP2221_ERROR_TIMEOUT;
+
+	memcpy(report, link->ready[0], MCP2221_REPORT_SIZE);
+	link->readyCount--;
+	memmove(link->ready[0], link->ready[1], link->readyCount * MCP2221_REPORT_SIZE);
+	return MCP2221_SUCCESS;
+}
+
+static void linkClose(void* handle)
+{
+	link_t* link = handle;
+	mcp2221_close(link->sim);
+	link->sim = NULL;
+}
+
+static const mcp2221_transport_t linkTransport = {
+	.send = linkSend,
+	.receive = linkReceive,
+	.close = linkClose,
+	.pollFd = NULL
+};
+
+static mcp2221_t* linkOpen(link_t* link)
+{
+	memset(link, 0x00, sizeof(link_t));
+	link->sim = mcp2221_open_sim();
+	if(!link->sim)
+		return NULL;
+	return mcp2221_open_transport(&linkTransport, link, NULL);
+}
+
+// With the SRAM cache on the getters don't ask the device, and the setters keep the cache up to date
+static void testSRAMCache(void)
+{
+	link_t link;
+	mcp2221_t* myDev = linkOpen(&link);
+	if(!myDev)
+	{
+		check(0, "open simulator link");
+		return;
+	}
+
+	mcp2221_dac_ref_t ref;
+	int value;
+	int sends = link.sends;
+	mcp2221_error res = mcp2221_getDAC(myDev, &ref, &value);
+	check(res == MCP2221_SUCCESS && link.sends == sends + 1, "getter asks the device with the cache off");
+
+	mcp2221_setSRAMCache(myDev, 1);
+
+	sends = link.sends;
+	res = mcp2221_getDAC(myDev, &ref, &value);
+	check(res == MCP2221_SUCCESS && link.sends == sends, "getter uses the cache");
+
+	uint32_t generation = mcp2221_getSRAMGeneration(myDev);
+	res = mcp2221_setDAC(myDev, MCP2221_DAC_REF_VDD, 20);
+	check(res == MCP2221_SUCCESS && mcp2221_getSRAMGeneration(myDev) != generation, "setter changes the cache generation");
+
+	sends = link.sends;
+	res = mcp2221_getDAC(myDev, &ref, &value);
+	check(res == MCP2221_SUCCESS && ref == MCP2221_DAC_REF_VDD && value == 20 && link.sends == sends, "cache has the new setting");
+
+	sends = link.sends;
+	res = mcp2221_refreshSRAM(myDev);
+	check(res == MCP2221_SUCCESS && link.sends == sends + 1, "refresh reads the device");
+
+	res = mcp2221_getDAC(myDev, &ref, &value);
+	check(res == MCP2221_SUCCESS && ref == MCP2221_DAC_REF_VDD && value == 20, "device agrees with the cache");
+
+	mcp2221_close(myDev);
+}
+
+// Writes that wouldn't change anything aren't sent
+static void testWriteSuppression(void)
+{
+	link_t link;
+	mcp2221_t* myDev = linkOpen(&link);
+	if(!myDev)
+	{
+		check(0, "open simulator link");
+		return;
+	}
+
+	mcp2221_setWriteSuppression(myDev, 1);
+	mcp2221_clearStats(myDev);
+
+	int sends = link.sends;
+	mcp2221_error res = mcp2221_setDAC(myDev, MCP2221_DAC_REF_VDD, 5);
+	check(res == MCP2221_SUCCESS && link.sends == sends + 1, "first write is sent");
+
+	sends = link.sends;
+	res = mcp2221_setDAC(myDev, MCP2221_DAC_REF_VDD, 5);
+	check(res == MCP2221_SUCCESS && link.sends == sends, "same write again isn't sent");
+
+	sends = link.sends;
+	res = mcp2221_setDAC(myDev, MCP2221_DAC_REF_VDD, 6);
+	check(res == MCP2221_SUCCESS && link.sends == sends + 1, "different value is sent");
+
+	sends = link.sends;
+	res = mcp2221_setGPIO(myDev, MCP2221_GPIO0, MCP2221_GPIO_VALUE_HIGH);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_setGPIO(myDev, MCP2221_GPIO0, MCP2221_GPIO_VALUE_HIGH);
+	check(res == MCP2221_SUCCESS && link.sends == sends + 1, "same GPIO output value isn't sent twice");
+
+	// Clearing the interrupt flag has to get to the device every time
+	sends = link.sends;
+	res = mcp2221_clearInterrupt(myDev);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_clearInterrupt(myDev);
+	check(res == MCP2221_SUCCESS && link.sends == sends + 2, "clearing the interrupt flag is always sent");
+
+	mcp2221_stats_t stats;
+	mcp2221_getStats(myDev, &stats);
+	check(stats.suppressedWrites == 2, "suppressed writes are counted");
+
+	mcp2221_setWriteSuppression(myDev, 0);
+	sends = link.sends;
+	res = mcp2221_setDAC(myDev, MCP2221_DAC_REF_VDD, 6);
+	check(res == MCP2221_SUCCESS && link.sends == sends + 1, "everything is sent with suppression off");
+
+	mcp2221_close(myDev);
+}
+
+// With the flash cache on all the sections are read at once and loads don't ask the device again
+static void testFlashCache(void)
+{
+	link_t link;
+	mcp2221_t* myDev = linkOpen(&link);
+	if(!myDev)
+	{
+		check(0, "open simulator link");
+		return;
+	}
+
+	mcp2221_setFlashCache(myDev, 1);
+
+	wchar_t buffer[MCP2221_STR_LEN];
+	int sends = link.sends;
+	mcp2221_error res = mcp2221_loadManufacturer(myDev, buffer);
+	check(res == MCP2221_SUCCESS && link.sends > sends, "first load reads the flash");
+
+	sends = link.sends;
+	int vid, pid;
+	res = mcp2221_loadProduct(myDev, buffer);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_loadVIDPID(myDev, &vid, &pid);
+	check(res == MCP2221_SUCCESS && link.sends == sends, "other loads use the cache");
+
+	res = mcp2221_saveProduct(myDev, L"Cached product");
+	sends = link.sends;
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_loadProduct(myDev, buffer);
+	check(res == MCP2221_SUCCESS && wcscmp(buffer, L"Cached product") == 0 && link.sends == sends, "save updates the cache");
+
+	mcp2221_invalidateFlash(myDev);
+	sends = link.sends;
+	res = mcp2221_loadProduct(myDev, buffer);
+	check(res == MCP2221_SUCCESS && wcscmp(buffer, L"Cached product") == 0 && link.sends > sends, "invalidated cache is read again");
+
+	mcp2221_setFlashCache(myDev, 0);
+	sends = link.sends;
+	res = mcp2221_loadProduct(myDev, buffer);
+	check(res == MCP2221_SUCCESS && link.sends == sends + 1, "load asks the device with the cache off");
+
+	mcp2221_close(myDev);
+}
+
+int main(void)
+{
+	mcp2221_init();
+
+	testSRAMCache();
+	testWriteSuppression();
+	testFlashCache();
+
+	mcp2221_exit();
+
+	printf("%d failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Context tests, run against the simulator so no hardware is needed
+
+#include <stdio.h>
+#include <string.h>
+#include "../../libmcp2221/libmcp2221.h"
+
+static int failed;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if(!ok)
+		failed++;
+}
+
+// A lazily opened device can outlive the context it was opened from, loading the rest of its USB info afterwards
+// mustn't touch the context
+static void testDeviceOutlivesContext(void)
+{
+	mcp2221_init();
+	mcp2221_setLazyOpen(1);
+
+	mcp2221_t* myDev = mcp2221_open_sim();
+	check(myDev && myDev->usbInfo.factorySerial[0] != 0x00, "lazy open still reads the factory serial");
+	if(!myDev)
+	{
+		mcp2221_exit();
+		return;
+	}
+
+	// Default context goes away here
+	mcp2221_exit();
+
+	mcp2221_usbinfo_t info;
+	mcp2221_error res = mcp2221_getUSBInfo(myDev, &info);
+	check(res == MCP2221_SUCCESS && info.product[0] != 0x00 && strcmp(info.factorySerial, myDev->usbInfo.factorySerial) == 0, "USB info loads after the context is gone");
+
+	mcp2221_close(myDev);
+}
+
+int main(void)
+{
+	testDeviceOutlivesContext();
+
+	printf("%d failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,225 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Flash edit session and password tests, run against the simulator so no hardware is needed
+
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include "../../libmcp2221/libmcp2221.h"
+
+#define LINK_QUEUE	8
+
+// Transport that passes reports on to a simulator and counts them, to see which calls do USB transactions
+typedef struct{
+	mcp2221_t* sim;
+	uint8_t ready[LINK_QUEUE][MCP2221_REPORT_SIZE];	// Responses waiting to be received
+	int readyCount;
+	int sends;		// Reports sent so far
+}link_t;
+
+static int failed;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if(!ok)
+		failed++;
+}
+
+static mcp2221_error linkSend(void* handle, uint8_t* report)
+{
+	link_t* link = handle;
+	link->sends++;
+
+	if(link->readyCount >= LINK_QUEUE)
+		return MCP2221_ERROR_HID;
+
+	uint8_t* response = link->ready[link->readyCount];
+	memcpy(response, report, MCP2221_REPORT_SIZE);
+	mcp2221_error res = mcp2221_rawReport(link->sim, response);
+	if(res != MCP2221_SUCCESS && res != MCP2221_ERROR_STATUS)
+		return MCP2221_ERROR_HID;
+
+	link->readyCount++;
+	return MCP2221_SUCCESS;
+}
+
+static mcp2221_error linkReceive(void* handle, uint8_t* report, int timeout)
+{
+	link_t* link = handle;
+	(void)timeout;
+
+	if(!link->readyCount)
+		return MCP2221_ERROR_TIMEOUT;
+
+	memcpy(report, link->ready[0], MCP2221_REPORT_SIZE);
+	link->readyCount--;
+	memmove(link->ready[0], link->ready[1], link->readyCount * MCP2221_REPORT_SIZE);
+	return MCP2221_SUCCESS;
+}
+
+static void linkClose(void* handle)
+{
+	link_t* link = handle;
+	mcp2221_close(link->sim);
+	link->sim = NULL;
+}
+
+static const mcp2221_transport_t linkTransport = {
+	.send = linkSend,
+	.receive = linkReceive,
+	.close = linkClose,
+	.pollFd = NULL
+};
+
+static mcp2221_t* linkOpen(link_t* link)
+{
+	memset(link, 0x00, sizeof(link_t));
+	link->sim = mcp2221_open_sim();
+	if(!link->sim)
+		return NULL;
+	return mcp2221_open_transport(&linkTransport, link, NULL);
+}
+
+// Saves in a session are kept in memory and each changed section is written once by the commit
+static void testSession(void)
+{
+	link_t link;
+	mcp2221_t* myDev = linkOpen(&link);
+	if(!myDev)
+	{
+		check(0, "open simulator link");
+		return;
+	}
+
+	mcp2221_error res = mcp2221_flashCommit(myDev);
+	check(res == MCP2221_ERROR, "commit without a session");
+
+	res = mcp2221_flashBegin(myDev);
+	check(res == MCP2221_SUCCESS, "begin session");
+
+	res = mcp2221_flashBegin(myDev);
+	check(res == MCP2221_ERROR, "only one session at a time");
+
+	// Manufacturer and product are different sections, VID/PID and milliamps are both in the chip settings
+	res = mcp2221_saveManufacturer(myDev, L"Session maker");
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_saveProduct(myDev, L"Session product");
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_saveVIDPID(myDev, 0x1234, 0x5678);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_saveMilliamps(myDev, 200);
+	check(res == MCP2221_SUCCESS, "saves in the session");
+
+	wchar_t buffer[MCP2221_STR_LEN];
+	int sends = link.sends;
+	res = mcp2221_loadProduct(myDev, buffer);
+	check(res == MCP2221_SUCCESS && wcscmp(buffer, L"Session product") == 0 && link.sends == sends, "loads see the uncommitted changes");
+
+	// A second open of the same simulator can't be done, so check the device through raw reads instead
+	mcp2221_report_t report;
+	memset(&report, 0x00, sizeof(report));
+	report.data[0] = 0xB0;	// READFLASH
+	report.data[1] = 0x03;	// USB product
+	res = mcp2221_rawReport(link.sim, report.data);
+	check(res == MCP2221_SUCCESS && report.data[4] != 'S', "device doesn't have the changes yet");
+
+	sends = link.sends;
+	res = mcp2221_flashCommit(myDev);
+	check(res == MCP2221_SUCCESS && link.sends == sends + 3, "commit writes each changed section once");
+
+	int vid, pid, milliamps;
+	res = mcp2221_loadVIDPID(myDev, &vid, &pid);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_loadMilliamps(myDev, &milliamps);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_loadManufacturer(myDev, buffer);
+	check(res == MCP2221_SUCCESS && vid == 0x1234 && pid == 0x5678 && milliamps == 200 && wcscmp(buffer, L"Session maker") == 0, "device has the changes");
+
+	// Cancelling throws the changes away
+	res = mcp2221_flashBegin(myDev);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_saveManufacturer(myDev, L"Cancelled");
+	sends = link.sends;
+	mcp2221_flashCancel(myDev);
+	check(res == MCP2221_SUCCESS && link.sends == sends, "cancel doesn't write anything");
+
+	res = mcp2221_loadManufacturer(myDev, buffer);
+	check(res == MCP2221_SUCCESS && wcscmp(buffer, L"Session maker") == 0, "cancelled change is gone");
+
+	mcp2221_close(myDev);
+}
+
+// Password protected flash has to be unlocked before it can be written
+static void testPassword(void)
+{
+	const uint8_t password[MCP2221_PASSWORD_LEN] = {'s', 'e', 'c', 'r', 'e', 't', '!', '!'};
+	const uint8_t wrong[MCP2221_PASSWORD_LEN] = {'w', 'r', 'o', 'n', 'g', '!', '!', '!'};
+
+	link_t link;
+	mcp2221_t* myDev = linkOpen(&link);
+	if(!myDev)
+	{
+		check(0, "open simulator link");
+		return;
+	}
+
+	mcp2221_error res = mcp2221_savePassword(myDev, password);
+	mcp2221_security_t security;
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_loadSecurity(myDev, &security);
+	check(res == MCP2221_SUCCESS && security == MCP2221_SECURITY_PASSWORD, "password protection turned on");
+
+	res = mcp2221_saveManufacturer(myDev, L"Locked");
+	check(res == MCP2221_ERROR_ACCESS, "write refused while locked");
+
+	res = mcp2221_unlockFlash(myDev, wrong);
+	check(res == MCP2221_ERROR_ACCESS, "wrong password refused");
+
+	res = mcp2221_unlockFlash(myDev, password);
+	check(res == MCP2221_SUCCESS, "right password accepted");
+
+	int sends = link.sends;
+	res = mcp2221_unlockFlash(myDev, password);
+	check(res == MCP2221_SUCCESS && link.sends == sends, "unlocking again with the same password isn't sent");
+
+	// Writing the chip settings keeps the password the same
+	res = mcp2221_saveManufacturer(myDev, L"Unlocked");
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_saveMilliamps(myDev, 300);
+	check(res == MCP2221_SUCCESS, "writes work once unlocked");
+
+	// Ask the simulator directly, the library would think it's already unlocked
+	mcp2221_report_t report;
+	memset(&report, 0x00, sizeof(report));
+	report.data[0] = 0xB2;	// Send access password
+	memcpy(&report.data[2], password, MCP2221_PASSWORD_LEN);
+	res = mcp2221_rawReport(link.sim, report.data);
+	check(res == MCP2221_SUCCESS, "password unchanged by chip settings write");
+
+	res = mcp2221_savePassword(myDev, NULL);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_loadSecurity(myDev, &security);
+	check(res == MCP2221_SUCCESS && security == MCP2221_SECURITY_UNSECURED, "password protection turned off");
+
+	mcp2221_close(myDev);
+}
+
+int main(void)
+{
+	mcp2221_init();
+
+	testSession();
+	testPassword();
+
+	mcp2221_exit();
+
+	printf("%d failed\n", failed);
+	return failed ? 1 : 0;
+}
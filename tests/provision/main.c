@@ -0,0 +1,78 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Provisioning tests, run against the simulator so no hardware is needed
+
+#include <stdio.h>
+#include "../../libmcp2221/libmcp2221.h"
+
+static int failed;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if(!ok)
+		failed++;
+}
+
+// Pins in ALT and dedicated modes leave direction and value as invalid, like examples/adc does
+// The first run should write the GPIO settings, after that there should be nothing to do
+static void testAltMode(void)
+{
+	mcp2221_t* myDev = mcp2221_open_sim();
+	if(!myDev)
+	{
+		check(0, "open simulator");
+		return;
+	}
+
+	mcp2221_profile_t profile = mcp2221_profileInit();
+	profile.fields = MCP2221_PROFILE_GPIOCONF;
+
+	profile.gpioConf.conf[0].gpios		= MCP2221_GPIO0;
+	profile.gpioConf.conf[0].mode		= MCP2221_GPIO_MODE_GPIO;
+	profile.gpioConf.conf[0].direction	= MCP2221_GPIO_DIR_OUTPUT;
+	profile.gpioConf.conf[0].value		= MCP2221_GPIO_VALUE_HIGH;
+
+	profile.gpioConf.conf[1].gpios		= MCP2221_GPIO1 | MCP2221_GPIO2;
+	profile.gpioConf.conf[1].mode		= MCP2221_GPIO_MODE_ALT1;
+
+	profile.gpioConf.conf[2].gpios		= MCP2221_GPIO3;
+	profile.gpioConf.conf[2].mode		= MCP2221_GPIO_MODE_DEDI;
+
+	mcp2221_provision_result_t result;
+	mcp2221_error res = mcp2221_provision(myDev, &profile, &result);
+	check(res == MCP2221_SUCCESS && result.result == MCP2221_SUCCESS && result.changed == 1, "ALT mode profile is written and verifies");
+
+	res = mcp2221_provision(myDev, &profile, &result);
+	check(res == MCP2221_SUCCESS && result.changed == 0, "ALT mode profile matches on the next run");
+
+	mcp2221_gpioconfset_t conf;
+	res = mcp2221_loadGPIOConf(myDev, &conf);
+	check(
+		res == MCP2221_SUCCESS &&
+		conf.conf[0].mode == MCP2221_GPIO_MODE_GPIO && conf.conf[0].value == MCP2221_GPIO_VALUE_HIGH &&
+		conf.conf[1].mode == MCP2221_GPIO_MODE_ALT1 && conf.conf[2].mode == MCP2221_GPIO_MODE_ALT1 &&
+		conf.conf[3].mode == MCP2221_GPIO_MODE_DEDI,
+		"GPIO settings in flash"
+	);
+
+	mcp2221_close(myDev);
+}
+
+int main(void)
+{
+	mcp2221_init();
+
+	testAltMode();
+
+	mcp2221_exit();
+
+	printf("%d failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Device registry and bulk open tests, no hardware is needed
+// The registry isn't part of the public API so this uses the library's internal functions, which the Windows DLL doesn't export
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../libmcp2221/libmcp2221.h"
+#include "../../libmcp2221/internal.h"
+
+#define BULK_COUNT	40 // More than there are threads in the pool
+
+static int failed;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if(!ok)
+		failed++;
+}
+
+// Check that the path found for a serial is the expected one, and free it
+static int pathIs(char* path, const char* expected)
+{
+	int ok = expected ? (path && strcmp(path, expected) == 0) : !path;
+	free(path);
+	return ok;
+}
+
+// Indexes stay the same as devices come and go
+static void testIndexes(void)
+{
+	registry_t* registry = registryCreate();
+	if(!registry)
+	{
+		check(0, "create registry");
+		return;
+	}
+
+	int a = registryAdd(registry, "/dev/hidraw0", L"A");
+	int b = registryAdd(registry, "/dev/hidraw1", L"B");
+	int c = registryAdd(registry, "/dev/hidraw2", NULL);
+	check(a == 0 && b == 1 && c == 2 && registryCount(registry) == 3, "devices get indexes in the order they were added");
+	check(registryAdd(registry, "/dev/hidraw1", L"B") == 1, "adding a path again gives the same index");
+	check(pathIs(registryFindSerial(registry, L"B"), "/dev/hidraw1"), "find by serial");
+	check(pathIs(registryPath(registry, 2), "/dev/hidraw2"), "path of an index");
+
+	registrySetFactorySerial(registry, "/dev/hidraw0", "FACTORY0");
+	check(pathIs(registryFindFactorySerial(registry, "FACTORY0"), "/dev/hidraw0"), "find by factory serial");
+
+	check(registryRemove(registry, "/dev/hidraw0") == 0, "remove a device");
+	check(registryRemove(registry, "/dev/hidraw0") == -1, "removing it again does nothing");
+	check(
+		registryCount(registry) == 3 && registryFindPath(registry, "/dev/hidraw0") == -1 && pathIs(registryPath(registry, 0), NULL),
+		"removed device keeps its index but can't be found"
+	);
+	check(pathIs(registryFindSerial(registry, L"A"), NULL) && pathIs(registryFindFactorySerial(registry, "FACTORY0"), NULL), "removed device can't be found by serial");
+	check(registryFindPath(registry, "/dev/hidraw1") == 1 && pathIs(registryPath(registry, 2), "/dev/hidraw2"), "other devices keep their indexes");
+
+	// hidraw numbers get reused, a device plugged in on the same path could be a different one
+	int d = registryAdd(registry, "/dev/hidraw0", L"D");
+	check(d == 3 && registryFindPath(registry, "/dev/hidraw0") == 3 && pathIs(registryPath(registry, 0), NULL), "returning path gets a new index");
+	check(pathIs(registryFindSerial(registry, L"D"), "/dev/hidraw0") && pathIs(registryFindFactorySerial(registry, "FACTORY0"), NULL), "returning path doesn't keep the old serials");
+
+	registryClear(registry);
+	check(registryCount(registry) == 0 && registryFindPath(registry, "/dev/hidraw1") == -1, "clear");
+
+	registryDestroy(registry);
+}
+
+// Lots of entries, so the hash tables have to grow
+static void testGrow(void)
+{
+	registry_t* registry = registryCreate();
+	if(!registry)
+	{
+		check(0, "create registry");
+		return;
+	}
+
+	int ok = 1;
+	char path[32];
+	wchar_t serial[32];
+	for(int i=0;i<1000 && ok;i++)
+	{
+		snprintf(path, sizeof(path), "/dev/hidraw%d", i);
+		swprintf(serial, 32, L"S%d", i);
+		ok = (registryAdd(registry, path, serial) == i);
+	}
+	check(ok, "add 1000 devices");
+
+	for(int i=0;i<1000 && ok;i++)
+	{
+		snprintf(path, sizeof(path), "/dev/hidraw%d", i);
+		swprintf(serial, 32, L"S%d", i);
+		ok = (registryFindPath(registry, path) == i && pathIs(registryFindSerial(registry, serial), path));
+	}
+	check(ok, "find all of them");
+
+	registryDestroy(registry);
+}
+
+// Devices that can't be opened are reported in the right place, everything else in the arrays is left alone
+static void testOpenAll(void)
+{
+	mcp2221_ctx_t* ctx = mcp2221_ctxCreate();
+	if(!ctx)
+	{
+		check(0, "create context");
+		return;
+	}
+
+	char path[32];
+	for(int i=0;i<BULK_COUNT;i++)
+	{
+		snprintf(path, sizeof(path), "/nonexistent/hidraw%d", i);
+		registryAdd(ctx->registry, path, NULL);
+	}
+
+	mcp2221_t* devices[BULK_COUNT + 1];
+	mcp2221_error results[BULK_COUNT + 1];
+	for(int i=0;i<BULK_COUNT + 1;i++)
+	{
+		devices[i] = (mcp2221_t*)ctx; // Anything that isn't NULL
+		results[i] = MCP2221_SUCCESS;
+	}
+
+	mcp2221_error res = mcp2221_ctxOpenAll(ctx, devices, results, BULK_COUNT);
+	int ok = (res == MCP2221_ERROR);
+	for(int i=0;i<BULK_COUNT;i++)
+	{
+		if(devices[i] || results[i] == MCP2221_SUCCESS)
+			ok = 0;
+	}
+	check(ok, "every device that can't be opened is reported");
+	check(devices[BULK_COUNT] == (mcp2221_t*)ctx && results[BULK_COUNT] == MCP2221_SUCCESS, "nothing past the end is touched");
+
+	res = mcp2221_ctxOpenAll(ctx, devices, NULL, BULK_COUNT);
+	check(res == MCP2221_ERROR, "results can be NULL");
+
+	check(mcp2221_ctxOpenAll(ctx, devices, results, 0) == MCP2221_SUCCESS, "nothing to open");
+	check(mcp2221_ctxOpenAll(NULL, devices, results, 1) == MCP2221_INVALID_ARG && mcp2221_ctxOpenAll(ctx, devices, results, -1) == MCP2221_INVALID_ARG, "invalid arguments");
+
+	// Provisioning uses the same pool of threads
+	mcp2221_profile_t profile = mcp2221_profileInit();
+	mcp2221_provision_result_t provisionResults[BULK_COUNT];
+	res = mcp2221_ctxProvisionAll(ctx, &profile, provisionResults, BULK_COUNT);
+	ok = (res == MCP2221_ERROR);
+	for(int i=0;i<BULK_COUNT;i++)
+	{
+		if(provisionResults[i].result != MCP2221_ERROR_HID)
+			ok = 0;
+	}
+	check(ok, "every device that can't be provisioned is reported");
+
+	mcp2221_ctxDestroy(ctx);
+}
+
+int main(void)
+{
+	mcp2221_init();
+
+	testIndexes();
+	testGrow();
+	testOpenAll();
+
+	mcp2221_exit();
+
+	printf("%d failed\n", failed);
+	return failed ? 1 : 0;
+}
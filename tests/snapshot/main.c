@@ -0,0 +1,86 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Snapshot tests, run against the simulator so no hardware is needed
+
+#include <stdio.h>
+#include <stdint.h>
+#include "../../libmcp2221/libmcp2221.h"
+
+static int failed;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if(!ok)
+		failed++;
+}
+
+// A snapshot of a password protected device doesn't hold the password, applying its chip settings to another device
+// must not turn on protection with whatever password the library has (all zeros if it was never given one)
+static void testPasswordSnapshot(void)
+{
+	const uint8_t password[MCP2221_PASSWORD_LEN] = {1, 2, 3, 4, 5, 6, 7, 8};
+	const uint8_t zeros[MCP2221_PASSWORD_LEN] = {0};
+
+	mcp2221_t* source = mcp2221_open_sim();
+	mcp2221_t* target = mcp2221_open_sim();
+	if(!source || !target)
+	{
+		check(0, "open simulators");
+		mcp2221_close(source);
+		mcp2221_close(target);
+		return;
+	}
+
+	mcp2221_snapshot_t snapshot;
+	mcp2221_error res = mcp2221_savePassword(source, password);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_snapshotTake(source, &snapshot);
+	check(res == MCP2221_SUCCESS, "snapshot of password protected device");
+
+	res = mcp2221_snapshotApply(target, &snapshot, MCP2221_SNAPSHOT_CHIPSETTINGS);
+	check(res == MCP2221_INVALID_ARG, "applying without a password is refused");
+
+	mcp2221_security_t security;
+	res = mcp2221_loadSecurity(target, &security);
+	check(res == MCP2221_SUCCESS && security == MCP2221_SECURITY_UNSECURED, "target is still unsecured");
+
+	// Other parts can still be applied
+	res = mcp2221_snapshotApply(target, &snapshot, MCP2221_SNAPSHOT_GPIOSETTINGS | MCP2221_SNAPSHOT_SRAM);
+	check(res == MCP2221_SUCCESS, "applying parts without chip settings works");
+
+	// Once the password is known the chip settings can be applied and the device takes that password
+	res = mcp2221_savePassword(target, password);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_unlockFlash(target, password);
+	if(res == MCP2221_SUCCESS)
+		res = mcp2221_snapshotApply(target, &snapshot, MCP2221_SNAPSHOT_CHIPSETTINGS);
+	check(res == MCP2221_SUCCESS, "applying with a password works");
+
+	res = mcp2221_loadSecurity(target, &security);
+	check(res == MCP2221_SUCCESS && security == MCP2221_SECURITY_PASSWORD, "target is password protected");
+
+	res = mcp2221_unlockFlash(target, zeros);
+	check(res == MCP2221_ERROR_ACCESS, "target doesn't have an all zero password");
+
+	mcp2221_close(source);
+	mcp2221_close(target);
+}
+
+int main(void)
+{
+	mcp2221_init();
+
+	testPasswordSnapshot();
+
+	mcp2221_exit();
+
+	printf("%d failed\n", failed);
+	return failed ? 1 : 0;
+}
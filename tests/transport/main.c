@@ -0,0 +1,232 @@
+/*
+ * Project: MCP2221 HID Library
+ * Author: Zak Kemble, contact@zakkemble.co.uk
+ * Copyright: (C) 2015 by Zak Kemble
+ * License: GNU GPL v3 (see License.txt)
+ * Web: http://blog.zakkemble.co.uk/mcp2221-hid-library/
+ */
+
+// Transport tests (timeouts, resyncing after late responses and retries), run against the simulator so no hardware is needed
+
+#include <stdio.h>
+#include <string.h>
+#include "../../libmcp2221/libmcp2221.h"
+
+#define LINK_QUEUE	8
+
+// Transport that passes reports on to a simulator, responses can be thrown away or held back to act like a flaky USB link
+typedef struct{
+	mcp2221_t* sim;
+	uint8_t ready[LINK_QUEUE][MCP2221_REPORT_SIZE];	// Responses waiting to be received
+	int readyCount;
+	uint8_t late[LINK_QUEUE][MCP2221_REPORT_SIZE];	// Held back responses, they turn up after the next report is sent
+	int lateCount;
+	int drop;		// Throw away this many of the next responses
+	int hold;		// Hold back this many of the next responses
+	int sends;		// Reports sent so far
+}link_t;
+
+static int failed;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if(!ok)
+		failed++;
+}
+
+static mcp2221_error linkSend(void* handle, uint8_t* report)
+{
+	link_t* link = handle;
+	link->sends++;
+
+	// Anything held back from earlier arrives first
+	for(int i=0;i<link->lateCount && link->readyCount < LINK_QUEUE;i++)
+		memcpy(link->ready[link->readyCount++], link->late[i], MCP2221_REPORT_SIZE);
+	link->lateCount = 0;
+
+	mcp2221_report_t response;
+	memcpy(response.data, report, MCP2221_REPORT_SIZE);
+	mcp2221_error res = mcp2221_rawReport(link->sim, response.data);
+	if(res != MCP2221_SUCCESS && res != MCP2221_ERROR_STATUS)
+		return MCP2221_ERROR_HID;
+
+	if(link->drop)
+		link->drop--;
+	else if(link->hold)
+	{
+		link->hold--;
+		if(link->lateCount < LINK_QUEUE)
+			memcpy(link->late[link->lateCount++], response.data, MCP2221_REPORT_SIZE);
+	}
+	else if(link->readyCount < LINK_QUEUE)
+		memcpy(link->ready[link->readyCount++], response.data, MCP2221_REPORT_SIZE);
+
+	return MCP2221_SUCCESS;
+}
+
+static mcp2221_error linkReceive(void* handle, uint8_t* report, int timeout)
+{
+	link_t* link = handle;
+	(void)timeout;
+
+	// Nothing is coming later unless another report is sent, so no need to actually wait
+	if(!link->readyCount)
+		return MCP2221_ERROR_TIMEOUT;
+
+	memcpy(report, link->ready[0], MCP2221_REPORT_SIZE);
+	link->readyCount--;
+	memmove(link->ready[0], link->ready[1], link->readyCount * MCP2221_REPORT_SIZE);
+	return MCP2221_SUCCESS;
+}
+
+static void linkClose(void* handle)
+{
+	link_t* link = handle;
+	mcp2221_close(link->sim);
+	link->sim = NULL;
+}
+
+static const mcp2221_transport_t linkTransport = {
+	.send = linkSend,
+	.receive = linkReceive,
+	.close = linkClose,
+	.pollFd = NULL
+};
+
+static mcp2221_t* linkOpen(link_t* link)
+{
+	memset(link, 0x00, sizeof(link_t));
+	link->sim = mcp2221_open_sim();
+	if(!link->sim)
+		return NULL;
+	return mcp2221_open_transport(&linkTransport, link, NULL);
+}
+
+// The adaptive timeout follows the measured round trip time, fixed timeouts are used as they are
+static void testAdaptiveTimeout(void)
+{
+	link_t link;
+	mcp2221_t* myDev = linkOpen(&link);
+	if(!myDev)
+	{
+		check(0, "open simulator link");
+		return;
+	}
+
+	// Opening did a few transactions so the round trip time has been measured, the simulator answers straight away
+	int adc[MCP2221_ADC_COUNT];
+	mcp2221_error res = mcp2221_readADC(myDev, adc);
+	check(res == MCP2221_SUCCESS && mcp2221_getTimeout(myDev) == 50, "adaptive timeout drops to the minimum for a fast device");
+
+	res = mcp2221_setTimeout(myDev, 200);
+	check(res == MCP2221_SUCCESS && mcp2221_getTimeout(myDev) == 200, "fixed timeout");
+
+	res = mcp2221_setTimeout(myDev, MCP2221_TIMEOUT_INFINITE);
+	check(res == MCP2221_SUCCESS && mcp2221_getTimeout(myDev) == MCP2221_TIMEOUT_INFINITE, "infinite timeout");
+
+	res = mcp2221_setTimeout(myDev, MCP2221_TIMEOUT_ADAPTIVE);
+	check(res == MCP2221_SUCCESS && mcp2221_getTimeout(myDev) == 50, "back to the adaptive timeout");
+
+	mcp2221_close(myDev);
+}
+
+// A response that turns up after its request timed out is thrown away instead of being taken as the response to the next request
+static void testLateResponse(void)
+{
+	link_t link;
+	mcp2221_t* myDev = linkOpen(&link);
+	if(!myDev)
+	{
+		check(0, "open simulator link");
+		return;
+	}
+
+	mcp2221_setRetry(myDev, 0, 0);
+	mcp2221_clearStats(myDev);
+
+	int adc[MCP2221_ADC_COUNT];
+	link.hold = 1;
+	mcp2221_error res = mcp2221_readADC(myDev, adc);
+	check(res == MCP2221_ERROR_TIMEOUT, "held back response times out");
+
+	// The late response is also a status response, it must not be mistaken for the new one
+	int values[MCP2221_ADC_COUNT] = {100, 200, 300};
+	mcp2221_simSetADC(link.sim, values);
+	res = mcp2221_readADC(myDev, adc);
+	check(res == MCP2221_SUCCESS && adc[0] == 100 && adc[1] == 200 && adc[2] == 300, "next request gets its own response");
+
+	mcp2221_stats_t stats;
+	mcp2221_getStats(myDev, &stats);
+	check(stats.timeouts == 1 && stats.staleResponses == 1 && stats.resyncs == 1, "timeout and resync are counted");
+
+	// A different type of request skips over the late response in the same way
+	link.hold = 1;
+	res = mcp2221_readADC(myDev, adc);
+	check(res == MCP2221_ERROR_TIMEOUT, "held back response times out again");
+
+	mcp2221_gpio_value_t gpios[MCP2221_GPIO_COUNT];
+	res = mcp2221_readGPIO(myDev, gpios);
+	mcp2221_getStats(myDev, &stats);
+	check(res == MCP2221_SUCCESS && stats.staleResponses == 2, "GPIO read skips the late status response");
+
+	mcp2221_close(myDev);
+}
+
+// Requests that only read something are sent again after a timeout, anything that changes settings isn't
+static void testRetry(void)
+{
+	link_t link;
+	mcp2221_t* myDev = linkOpen(&link);
+	if(!myDev)
+	{
+		check(0, "open simulator link");
+		return;
+	}
+
+	mcp2221_setRetry(myDev, 2, 0);
+	mcp2221_clearStats(myDev);
+
+	int adc[MCP2221_ADC_COUNT];
+	int sends = link.sends;
+	link.hold = 1;
+	mcp2221_error res = mcp2221_readADC(myDev, adc);
+	check(res == MCP2221_SUCCESS && link.sends == sends + 2, "timed out read is retried");
+
+	mcp2221_stats_t stats;
+	mcp2221_getStats(myDev, &stats);
+	check(stats.retries == 1 && stats.recovered == 1, "retry and recovery are counted");
+
+	mcp2221_clearStats(myDev);
+	sends = link.sends;
+	link.drop = 3;
+	res = mcp2221_readADC(myDev, adc);
+	mcp2221_getStats(myDev, &stats);
+	check(res == MCP2221_ERROR_TIMEOUT && link.sends == sends + 3 && stats.retries == 2 && stats.recovered == 0, "gives up after the retry limit");
+
+	sends = link.sends;
+	link.drop = 1;
+	res = mcp2221_setDAC(myDev, MCP2221_DAC_REF_VDD, 10);
+	check(res == MCP2221_ERROR_TIMEOUT && link.sends == sends + 1, "lost write isn't sent again");
+
+	mcp2221_dac_ref_t ref;
+	int value;
+	res = mcp2221_getDAC(myDev, &ref, &value);
+	check(res == MCP2221_SUCCESS && value == 10, "write still reached the device");
+
+	mcp2221_close(myDev);
+}
+
+int main(void)
+{
+	mcp2221_init();
+
+	testAdaptiveTimeout();
+	testLateResponse();
+	testRetry();
+
+	mcp2221_exit();
+
+	printf("%d failed\n", failed);
+	return failed ? 1 : 0;
+}